@@ -0,0 +1,113 @@
+/*
+ * Times every code path of the row converters in convert-pixels.cpp on
+ * the same rows, and checks that they agree with the scalar path.
+ *
+ * The converter variants are private to convert-pixels.cpp, so it is
+ * compiled into this program directly. Paths the CPU can't run are
+ * skipped.
+ */
+
+#include "../src/scene/convert-pixels.cpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using std::vector;
+
+#define BENCH_WIDTH 4096
+#define BENCH_ROWS 1024
+#define BENCH_RUNS 5
+
+// best of BENCH_RUNS, in GB/s of source data
+template <typename Src, typename Dst>
+static double timeConverter(void (*convert)(const Src *, Dst *, int), const vector<Src> &src, vector<Dst> &dst, int srcChannels, int dstChannels)
+{
+	auto best = 1e30;
+	for (auto run = 0; run < BENCH_RUNS; ++run) {
+		auto start = std::chrono::steady_clock::now();
+		for (auto row = 0; row < BENCH_ROWS; ++row)
+			convert(src.data() + size_t(row) * BENCH_WIDTH * srcChannels, dst.data() + size_t(row) * BENCH_WIDTH * dstChannels, BENCH_WIDTH);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		best = std::min(best, elapsed.count());
+	}
+
+	return double(src.size() * sizeof(Src)) / best * 1e-9;
+}
+
+template <typename Src, typename Dst>
+struct Variant {
+	const char *name;
+	void (*convert)(const Src *, Dst *, int);
+	bool supported;
+};
+
+template <typename Src, typename Dst>
+static void bench(const char *name, const vector<Variant<Src, Dst>> &variants, const vector<Src> &src, int srcChannels, int dstChannels)
+{
+	printf("%s\n", name);
+
+	vector<Dst> reference(size_t(BENCH_WIDTH) * BENCH_ROWS * dstChannels);
+	vector<Dst> dst(reference.size());
+	double scalar = 0.0;
+	for (auto &variant : variants) {
+		if (!variant.supported) {
+			printf("  %-8s unsupported on this CPU\n", variant.name);
+			continue;
+		}
+
+		auto gbps = timeConverter(variant.convert, src, &variant == &variants[0] ? reference : dst, srcChannels, dstChannels);
+		if (&variant == &variants[0])
+			scalar = gbps;
+		else if (memcmp(dst.data(), reference.data(), dst.size() * sizeof(Dst)) != 0)
+			printf("  %-8s MISMATCH against scalar\n", variant.name);
+
+		printf("  %-8s %6.2f GB/s  %5.2fx\n", variant.name, gbps, gbps / scalar);
+	}
+}
+
+int main()
+{
+	const auto &cpu = getCpuFeatures();
+	srand(1);
+
+	vector<uint8_t> bytes(size_t(BENCH_WIDTH) * BENCH_ROWS * 4);
+	for (auto &byte : bytes)
+		byte = uint8_t(rand());
+
+	// mostly in [0, 1], with some out-of-range values to hit the clamps
+	vector<float> floats(size_t(BENCH_WIDTH) * BENCH_ROWS * 3);
+	for (auto &value : floats)
+		value = float(rand()) / RAND_MAX * 1.25f - 0.125f;
+
+	printf("%d rows of %d pixels, best of %d runs\n\n", BENCH_ROWS, BENCH_WIDTH, BENCH_RUNS);
+
+	bench<uint8_t, uint8_t>("RGBA8 swizzle", {
+		{ "scalar", convertRowRGBA8_Scalar, true },
+		{ "SSSE3", convertRowRGBA8_SSSE3, cpu.ssse3 },
+		{ "AVX2", convertRowRGBA8_AVX2, cpu.avx2 },
+	}, bytes, 4, 4);
+
+	bench<uint8_t, uint8_t>("RGB8 to RGBA8", {
+		{ "scalar", convertRowRGB8_Scalar, true },
+		{ "SSSE3", convertRowRGB8_SSSE3, cpu.ssse3 },
+	}, vector<uint8_t>(bytes.begin(), bytes.begin() + bytes.size() / 4 * 3), 3, 4);
+
+	bench<float, uint16_t>("RGB float to RGBA half", {
+		{ "scalar", convertRowRGBF_Scalar, true },
+		{ "F16C", convertRowRGBF_F16C, cpu.f16c },
+	}, floats, 3, 4);
+
+	bench<float, uint32_t>("RGB float to A2B10G10R10", {
+		{ "scalar", convertRowRGBFToA2B10G10R10_Scalar, true },
+		{ "SSE2", convertRowRGBFToA2B10G10R10_SSE2, true },
+	}, floats, 3, 1);
+
+	bench<float, uint32_t>("RGB float to B10G11R11", {
+		{ "scalar", convertRowRGBFToB10G11R11_Scalar, true },
+		{ "SSE2", convertRowRGBFToB10G11R11_SSE2, true },
+	}, floats, 3, 1);
+
+	return 0;
+}
@@ -0,0 +1,104 @@
+/*
+ * Times parseCubeLut on generated 17^3, 33^3 and 65^3 LUTs, against the
+ * getline and stringstream parsing it replaced, and checks that both read
+ * the same values.
+ */
+
+#include "../src/scene/cube-lut.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+#define BENCH_RUNS 5
+
+// Colors with 6 decimals, as most tools write them, after a typical header
+static string generateCubeLut(int size)
+{
+	string text = "# generated\nTITLE \"bench\"\nLUT_3D_SIZE " + std::to_string(size) + "\n";
+	text += "DOMAIN_MIN 0.0 0.0 0.0\nDOMAIN_MAX 1.0 1.0 1.0\n\n";
+
+	char line[64];
+	for (auto i = 0; i < size * size * size * 3; i += 3) {
+		snprintf(line, sizeof(line), "%.6f %.6f %.6f\n",
+		         double(rand()) / RAND_MAX, double(rand()) / RAND_MAX, double(rand()) / RAND_MAX);
+		text += line;
+	}
+	return text;
+}
+
+// What importCubeFile did before, minus the header handling
+static vector<float> parseWithStringstream(const string &text)
+{
+	vector<float> colors;
+	std::istringstream file(text);
+	string line;
+	while (std::getline(file, line)) {
+		if (line.empty() || line[0] == '#' || isalpha((unsigned char)line[0]))
+			continue;
+
+		std::stringstream stream(line);
+		float r, g, b;
+		stream >> r >> g >> b;
+		colors.push_back(r);
+		colors.push_back(g);
+		colors.push_back(b);
+	}
+	return colors;
+}
+
+// best of BENCH_RUNS, in milliseconds
+template <typename F>
+static double timeParser(F parse)
+{
+	auto best = 1e30;
+	for (auto run = 0; run < BENCH_RUNS; ++run) {
+		auto start = std::chrono::steady_clock::now();
+		parse();
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		best = std::min(best, elapsed.count());
+	}
+	return best;
+}
+
+int main()
+{
+	srand(1);
+	printf("best of %d runs\n\n", BENCH_RUNS);
+	printf("size  text      stringstream           parseCubeLut\n");
+
+	for (auto size : { 17, 33, 65 }) {
+		auto text = generateCubeLut(size);
+		auto megabytes = text.size() / 1e6;
+
+		vector<float> reference;
+		auto streamTime = timeParser([&] {
+			reference = parseWithStringstream(text);
+		});
+
+		CubeLut lut;
+		auto parseTime = timeParser([&] {
+			lut = parseCubeLut(text.data(), text.size());
+		});
+
+		printf("%2d^3  %5.1f MB  %8.2f ms (%4.0f MB/s)  %7.2f ms (%4.0f MB/s)  %5.1fx\n",
+		       size, megabytes,
+		       streamTime, megabytes / streamTime * 1e3,
+		       parseTime, megabytes / parseTime * 1e3,
+		       streamTime / parseTime);
+
+		if (lut.size != size || lut.colors.size() != reference.size() ||
+		    memcmp(lut.colors.data(), reference.data(), reference.size() * sizeof(float)) != 0)
+			printf("      MISMATCH against stringstream\n");
+	}
+
+	return 0;
+}
@@ -0,0 +1,162 @@
+#include "assetpack.h"
+#include "replacefile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+using std::string;
+using std::vector;
+using std::runtime_error;
+
+static uint64_t alignOffset(uint64_t offset, uint64_t alignment)
+{
+	return ((offset + alignment - 1) / alignment) * alignment;
+}
+
+AssetPack::AssetPack(const string &path) :
+	file(path, MAP_HINT_RANDOM)
+{
+	if (file.getSize() < sizeof(AssetPackHeader))
+		throw runtime_error("truncated asset pack");
+
+	header = static_cast<const AssetPackHeader *>(file.getData());
+	if (memcmp(header->magic, ASSET_PACK_MAGIC, sizeof(header->magic)) != 0)
+		throw runtime_error("not an asset pack");
+
+	if (header->version != ASSET_PACK_VERSION)
+		throw runtime_error("unsupported asset pack version");
+
+	if (header->entryCount > (file.getSize() - sizeof(AssetPackHeader)) / sizeof(AssetPackEntry))
+		throw runtime_error("truncated asset pack");
+
+	entries = reinterpret_cast<const AssetPackEntry *>(header + 1);
+	for (auto i = 0u; i < header->entryCount; ++i) {
+		const auto &entry = entries[i];
+		if (memchr(entry.name, '\0', sizeof(entry.name)) == nullptr)
+			throw runtime_error("corrupt asset pack entry name");
+
+		if (entry.offset % ASSET_PACK_ALIGNMENT != 0 ||
+		    entry.offset > file.getSize() ||
+		    entry.size > file.getSize() - entry.offset)
+			throw runtime_error("corrupt asset pack entry");
+
+		if (i > 0 && strcmp(entries[i - 1].name, entry.name) >= 0)
+			throw runtime_error("asset pack entries not sorted");
+	}
+}
+
+const AssetPackEntry *AssetPack::findEntry(const string &name) const
+{
+	auto end = entries + header->entryCount;
+	auto it = std::lower_bound(entries, end, name, [](const AssetPackEntry &entry, const string &name) {
+		return strcmp(entry.name, name.c_str()) < 0;
+	});
+
+	if (it == end || name != it->name)
+		return nullptr;
+
+	return it;
+}
+
+const AssetPackEntry &AssetPack::getEntry(const string &name) const
+{
+	auto entry = findEntry(name);
+	if (entry == nullptr)
+		throw runtime_error("asset not found in pack: " + name);
+
+	return *entry;
+}
+
+void AssetPackWriter::addBlob(const string &name, const void *data, size_t size)
+{
+	AssetPackTextureInfo info = {};
+	addEntry(name, ASSET_PACK_BLOB, info, data, size);
+}
+
+void AssetPackWriter::addTexture(const string &name, const AssetPackTextureInfo &info, const void *data, size_t size)
+{
+	addEntry(name, ASSET_PACK_TEXTURE, info, data, size);
+}
+
+void AssetPackWriter::addEntry(const string &name, AssetPackEntryType type, const AssetPackTextureInfo &info, const void *data, size_t size)
+{
+	if (name.empty() || name.size() >= ASSET_PACK_MAX_NAME)
+		throw runtime_error("invalid asset name: " + name);
+
+	for (const auto &entry : entries)
+		if (name == entry.name)
+			throw runtime_error("duplicate asset name: " + name);
+
+	AssetPackEntry entry = {};
+	memcpy(entry.name, name.c_str(), name.size());
+	entry.type = type;
+	entry.texture = info;
+	entry.size = size;
+	entries.push_back(entry);
+
+	auto bytes = static_cast<const uint8_t *>(data);
+	payloads.emplace_back(bytes, bytes + size);
+}
+
+void AssetPackWriter::write(const string &path) const
+{
+	vector<size_t> order(entries.size());
+	for (auto i = 0u; i < order.size(); ++i)
+		order[i] = i;
+
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return strcmp(entries[a].name, entries[b].name) < 0;
+	});
+
+	AssetPackHeader header = {};
+	memcpy(header.magic, ASSET_PACK_MAGIC, sizeof(header.magic));
+	header.version = ASSET_PACK_VERSION;
+	header.entryCount = uint32_t(entries.size());
+
+	vector<AssetPackEntry> toc;
+	toc.reserve(entries.size());
+
+	uint64_t offset = sizeof(header) + sizeof(AssetPackEntry) * entries.size();
+	for (auto index : order) {
+		offset = alignOffset(offset, ASSET_PACK_ALIGNMENT);
+
+		auto entry = entries[index];
+		entry.offset = offset;
+		toc.push_back(entry);
+
+		offset += entry.size;
+	}
+
+	// write to a temporary file and move it into place, so readers never see a partial pack
+	auto tempPath = path + ".tmp";
+	FILE *fp = fopen(tempPath.c_str(), "wb");
+	if (fp == nullptr)
+		throw runtime_error("failed to open file for writing");
+
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+	if (!toc.empty())
+		ok = ok && fwrite(toc.data(), sizeof(AssetPackEntry), toc.size(), fp) == toc.size();
+
+	static const uint8_t padding[ASSET_PACK_ALIGNMENT] = {};
+	uint64_t position = sizeof(header) + sizeof(AssetPackEntry) * toc.size();
+	for (auto i = 0u; ok && i < toc.size(); ++i) {
+		const auto &payload = payloads[order[i]];
+		auto paddingSize = size_t(toc[i].offset - position);
+		ok = fwrite(padding, 1, paddingSize, fp) == paddingSize;
+		ok = ok && fwrite(payload.data(), 1, payload.size(), fp) == payload.size();
+		position = toc[i].offset + payload.size();
+	}
+
+	ok = fclose(fp) == 0 && ok;
+	if (!ok) {
+		remove(tempPath.c_str());
+		throw runtime_error("failed to write asset pack");
+	}
+
+	if (!replaceFile(tempPath, path)) {
+		remove(tempPath.c_str());
+		throw runtime_error("failed to move asset pack into place");
+	}
+}
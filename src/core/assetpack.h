@@ -0,0 +1,91 @@
+#ifndef ASSETPACK_H
+#define ASSETPACK_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "memorymappedfile.h"
+
+/*
+ * Asset packs are a single file holding cooked, GPU-ready assets:
+ *
+ *   AssetPackHeader
+ *   AssetPackEntry[entryCount], sorted by name
+ *   payloads, each starting at a multiple of ASSET_PACK_ALIGNMENT
+ *
+ * Texture payloads are stored in TextureLayout order (all array layers of
+ * mip 0, then all of mip 1, ...), in their final format, so they can be
+ * copied straight into a staging buffer.
+ */
+
+#define ASSET_PACK_MAGIC "ELAP"
+#define ASSET_PACK_VERSION 1
+#define ASSET_PACK_ALIGNMENT 256
+#define ASSET_PACK_MAX_NAME 96
+
+enum AssetPackEntryType {
+	ASSET_PACK_BLOB = 0,
+	ASSET_PACK_TEXTURE = 1,
+};
+
+struct AssetPackHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t entryCount;
+	uint32_t reserved;
+};
+
+struct AssetPackTextureInfo {
+	uint32_t format; // VkFormat
+	uint32_t viewType; // VkImageViewType
+	int32_t width, height, depth;
+	int32_t mipLevels, arrayLayers;
+};
+
+struct AssetPackEntry {
+	char name[ASSET_PACK_MAX_NAME];
+	uint32_t type;
+	AssetPackTextureInfo texture;
+	uint64_t offset;
+	uint64_t size;
+};
+
+static_assert(sizeof(AssetPackHeader) == 16, "unexpected header size");
+static_assert(sizeof(AssetPackEntry) == 144, "unexpected entry size");
+
+class AssetPack {
+public:
+	explicit AssetPack(const std::string &path);
+
+	const AssetPackEntry *findEntry(const std::string &name) const;
+	const AssetPackEntry &getEntry(const std::string &name) const;
+
+	const void *getData(const AssetPackEntry &entry) const
+	{
+		return static_cast<const uint8_t *>(file.getData()) + entry.offset;
+	}
+
+	uint32_t getEntryCount() const { return header->entryCount; }
+
+private:
+	MemoryMappedFile file;
+	const AssetPackHeader *header;
+	const AssetPackEntry *entries;
+};
+
+class AssetPackWriter {
+public:
+	void addBlob(const std::string &name, const void *data, size_t size);
+	void addTexture(const std::string &name, const AssetPackTextureInfo &info, const void *data, size_t size);
+
+	void write(const std::string &path) const;
+
+private:
+	void addEntry(const std::string &name, AssetPackEntryType type, const AssetPackTextureInfo &info, const void *data, size_t size);
+
+	std::vector<AssetPackEntry> entries;
+	std::vector<std::vector<uint8_t>> payloads;
+};
+
+#endif // ASSETPACK_H
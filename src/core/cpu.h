@@ -0,0 +1,85 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdint.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+// Lets code built for the x64 baseline use newer instructions in selected
+// functions. MSVC allows any intrinsic anywhere, so it needs nothing.
+#if defined(__GNUC__)
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_F16C __attribute__((target("avx,f16c")))
+#else
+#define TARGET_SSSE3
+#define TARGET_AVX2
+#define TARGET_F16C
+#endif
+
+struct CpuFeatures {
+	bool ssse3;
+	bool avx2;
+	bool f16c;
+};
+
+namespace cpu_detail
+{
+	inline void cpuid(int leaf, int subleaf, uint32_t regs[4])
+	{
+#ifdef _MSC_VER
+		__cpuidex(reinterpret_cast<int *>(regs), leaf, subleaf);
+#else
+		__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	}
+
+	inline uint64_t xgetbv(uint32_t index)
+	{
+#ifdef _MSC_VER
+		return _xgetbv(index);
+#else
+		uint32_t lo, hi;
+		__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(index));
+		return (uint64_t(hi) << 32) | lo;
+#endif
+	}
+
+	inline CpuFeatures detect()
+	{
+		CpuFeatures features = {};
+
+		uint32_t regs[4];
+		cpuid(0, 0, regs);
+		auto maxLeaf = regs[0];
+
+		cpuid(1, 0, regs);
+		features.ssse3 = (regs[2] & (1 << 9)) != 0;
+
+		// AVX state must be enabled by the OS, or using ymm registers faults
+		bool osxsave = (regs[2] & (1 << 27)) != 0;
+		bool avx = (regs[2] & (1 << 28)) != 0;
+		bool osAVX = osxsave && avx && (xgetbv(0) & 6) == 6;
+
+		features.f16c = osAVX && (regs[2] & (1 << 29)) != 0;
+
+		if (maxLeaf >= 7) {
+			cpuid(7, 0, regs);
+			features.avx2 = osAVX && (regs[1] & (1 << 5)) != 0;
+		}
+
+		return features;
+	}
+}
+
+inline const CpuFeatures &getCpuFeatures()
+{
+	static const CpuFeatures features = cpu_detail::detect();
+	return features;
+}
+
+#endif // CPU_H
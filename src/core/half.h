@@ -0,0 +1,73 @@
+#ifndef HALF_H
+#define HALF_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Portable IEEE half-float conversion, for CPUs without F16C
+
+inline uint16_t floatToHalf(float value)
+{
+	const uint32_t f32infty = 255 << 23;
+	const uint32_t f16max = (127 + 16) << 23;
+	const uint32_t denormMagic = ((127 - 15) + (23 - 10) + 1) << 23;
+
+	uint32_t f;
+	memcpy(&f, &value, sizeof(f));
+
+	uint32_t sign = f & 0x80000000u;
+	f ^= sign;
+
+	uint32_t ret;
+	if (f >= f16max) {
+		// overflow to inf, or NaN
+		ret = f > f32infty ? 0x7e00 : 0x7c00;
+	} else if (f < (113 << 23)) {
+		// denormal or zero, let the FPU do the rounding
+		float temp, magic;
+		memcpy(&temp, &f, sizeof(temp));
+		memcpy(&magic, &denormMagic, sizeof(magic));
+		temp += magic;
+		memcpy(&ret, &temp, sizeof(ret));
+		ret -= denormMagic;
+	} else {
+		// rebias the exponent, and round to nearest even
+		uint32_t mantissaOdd = (f >> 13) & 1;
+		f += (uint32_t(15 - 127) << 23) + 0xfff;
+		f += mantissaOdd;
+		ret = f >> 13;
+	}
+
+	return uint16_t(ret | (sign >> 16));
+}
+
+inline float halfToFloat(uint16_t value)
+{
+	const uint32_t shiftedExp = 0x7c00 << 13;
+
+	uint32_t ret = (value & 0x7fff) << 13;
+	uint32_t exp = shiftedExp & ret;
+	ret += (127 - 15) << 23;
+
+	if (exp == shiftedExp) {
+		// inf or NaN
+		ret += (128 - 16) << 23;
+	} else if (exp == 0) {
+		// zero or denormal, renormalize
+		const uint32_t magicBits = 113 << 23;
+		float temp, magic;
+		ret += 1 << 23;
+		memcpy(&temp, &ret, sizeof(temp));
+		memcpy(&magic, &magicBits, sizeof(magic));
+		temp -= magic;
+		memcpy(&ret, &temp, sizeof(ret));
+	}
+
+	ret |= uint32_t(value & 0x8000) << 16;
+
+	float f;
+	memcpy(&f, &ret, sizeof(f));
+	return f;
+}
+
+#endif // HALF_H
@@ -0,0 +1,106 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+#include <string.h>
+
+// 64-bit xxHash (XXH64), for content-addressing assets
+
+namespace hash_detail
+{
+	static const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+	static const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+	static const uint64_t prime3 = 0x165667B19E3779F9ULL;
+	static const uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+	static const uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+	inline uint64_t rotl(uint64_t x, int r)
+	{
+		return (x << r) | (x >> (64 - r));
+	}
+
+	inline uint64_t read64(const uint8_t *p)
+	{
+		uint64_t ret;
+		memcpy(&ret, p, sizeof(ret));
+		return ret;
+	}
+
+	inline uint32_t read32(const uint8_t *p)
+	{
+		uint32_t ret;
+		memcpy(&ret, p, sizeof(ret));
+		return ret;
+	}
+
+	inline uint64_t round(uint64_t acc, uint64_t input)
+	{
+		acc += input * prime2;
+		acc = rotl(acc, 31);
+		return acc * prime1;
+	}
+
+	inline uint64_t mergeRound(uint64_t acc, uint64_t val)
+	{
+		acc ^= round(0, val);
+		return acc * prime1 + prime4;
+	}
+}
+
+inline uint64_t hash64(const void *data, size_t size, uint64_t seed = 0)
+{
+	using namespace hash_detail;
+
+	auto p = static_cast<const uint8_t *>(data);
+	auto end = p + size;
+	uint64_t h;
+
+	if (size >= 32) {
+		uint64_t v1 = seed + prime1 + prime2;
+		uint64_t v2 = seed + prime2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - prime1;
+
+		do {
+			v1 = round(v1, read64(p));
+			v2 = round(v2, read64(p + 8));
+			v3 = round(v3, read64(p + 16));
+			v4 = round(v4, read64(p + 24));
+			p += 32;
+		} while (p <= end - 32);
+
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		h = mergeRound(h, v1);
+		h = mergeRound(h, v2);
+		h = mergeRound(h, v3);
+		h = mergeRound(h, v4);
+	} else
+		h = seed + prime5;
+
+	h += uint64_t(size);
+
+	for (; p + 8 <= end; p += 8) {
+		h ^= round(0, read64(p));
+		h = rotl(h, 27) * prime1 + prime4;
+	}
+
+	if (p + 4 <= end) {
+		h ^= uint64_t(read32(p)) * prime1;
+		h = rotl(h, 23) * prime2 + prime3;
+		p += 4;
+	}
+
+	for (; p < end; ++p) {
+		h ^= (*p) * prime5;
+		h = rotl(h, 11) * prime1;
+	}
+
+	h ^= h >> 33;
+	h *= prime2;
+	h ^= h >> 29;
+	h *= prime3;
+	h ^= h >> 32;
+	return h;
+}
+
+#endif // HASH_H
@@ -1,50 +1,169 @@
 #ifndef MEMORYMAPPEDFILE_H
 #define MEMORYMAPPEDFILE_H
 
+#include <stdint.h>
+#include <string>
+#include <stdexcept>
+
 #ifdef WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
+enum MemoryMapHints {
+	MAP_HINT_NONE = 0,
+	MAP_HINT_SEQUENTIAL = 1 << 0, // aggressive read-ahead, pages can be dropped behind us
+	MAP_HINT_RANDOM = 1 << 1, // no read-ahead
+	MAP_HINT_PREFETCH = 1 << 2, // start paging in the whole file right away
+	MAP_HINT_HUGE_PAGES = 1 << 3, // back the mapping with huge pages, if the OS can
+};
+
+inline MemoryMapHints operator|(const MemoryMapHints &a, const MemoryMapHints &b)
+{
+	return static_cast<MemoryMapHints>(static_cast<int>(a) | static_cast<int>(b));
+}
+
+// Empty files give a null data pointer and a size of 0 on every platform
 class MemoryMappedFile
 {
 public:
-	explicit MemoryMappedFile(const std::string &path)
+	explicit MemoryMappedFile(const std::string &path, MemoryMapHints hints = MAP_HINT_NONE)
 	{
-		WIN32_FILE_ATTRIBUTE_DATA attr;
-		if (!GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &attr))
-			throw std::runtime_error("failed to get file attributes");
-		size = attr.nFileSizeLow;
+		if ((hints & MAP_HINT_SEQUENTIAL) && (hints & MAP_HINT_RANDOM))
+			throw std::runtime_error("conflicting access hints");
 
-		if (attr.nFileSizeHigh != 0)
-			throw std::runtime_error("too large file");
+#ifdef WIN32
+		DWORD flags = FILE_ATTRIBUTE_NORMAL;
+		if (hints & MAP_HINT_SEQUENTIAL)
+			flags |= FILE_FLAG_SEQUENTIAL_SCAN;
+		if (hints & MAP_HINT_RANDOM)
+			flags |= FILE_FLAG_RANDOM_ACCESS;
 
-		hfile = CreateFile(path.c_str(), GENERIC_READ, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		hfile = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags, nullptr);
 		if (INVALID_HANDLE_VALUE == hfile)
 			throw std::runtime_error("failed to open file for reading");
 
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(hfile, &fileSize)) {
+			CloseHandle(hfile);
+			throw std::runtime_error("failed to get file size");
+		}
+
+		if (uint64_t(fileSize.QuadPart) > SIZE_MAX) {
+			CloseHandle(hfile);
+			throw std::runtime_error("too large file");
+		}
+		size = size_t(fileSize.QuadPart);
+
+		if (size == 0) {
+			// CreateFileMapping refuses empty files
+			CloseHandle(hfile);
+			hfile = INVALID_HANDLE_VALUE;
+			hmap = nullptr;
+			data = nullptr;
+			return;
+		}
+
 		hmap = CreateFileMapping(hfile, 0, PAGE_READONLY, 0, 0, nullptr);
-		if (!hmap)
+		if (!hmap) {
+			CloseHandle(hfile);
 			throw std::runtime_error("failed to create file mapping");
+		}
 
 		data = MapViewOfFile(hmap, FILE_MAP_READ, 0, 0, 0);
-		if (!data)
+		if (!data) {
+			CloseHandle(hmap);
+			CloseHandle(hfile);
 			throw std::runtime_error("failed to map view of file");
+		}
+
+#if defined(_WIN32_WINNT_WIN8) && _WIN32_WINNT >= _WIN32_WINNT_WIN8
+		if (hints & MAP_HINT_PREFETCH) {
+			WIN32_MEMORY_RANGE_ENTRY range = { data, size };
+			PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+		}
+#endif
+		// file-backed sections can't use large pages, so MAP_HINT_HUGE_PAGES is a no-op here
+#else
+		int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			throw std::runtime_error("failed to open file for reading");
+
+		struct stat st;
+		if (fstat(fd, &st) < 0) {
+			close(fd);
+			throw std::runtime_error("failed to get file attributes");
+		}
+
+		if (uint64_t(st.st_size) > SIZE_MAX) {
+			close(fd);
+			throw std::runtime_error("too large file");
+		}
+		size = size_t(st.st_size);
+
+		if (size == 0) {
+			// mmap refuses empty files
+			close(fd);
+			data = nullptr;
+			return;
+		}
+
+#ifdef POSIX_FADV_SEQUENTIAL
+		if (hints & MAP_HINT_SEQUENTIAL)
+			posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		if (hints & MAP_HINT_RANDOM)
+			posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+#endif
+
+		data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd); // the mapping keeps its own reference to the file
+		if (data == MAP_FAILED)
+			throw std::runtime_error("failed to map file");
+
+		// these are only hints, so failures are ignored
+		if (hints & MAP_HINT_SEQUENTIAL)
+			madvise(data, size, MADV_SEQUENTIAL);
+		if (hints & MAP_HINT_RANDOM)
+			madvise(data, size, MADV_RANDOM);
+#ifdef MADV_HUGEPAGE
+		if (hints & MAP_HINT_HUGE_PAGES)
+			madvise(data, size, MADV_HUGEPAGE);
+#endif
+		if (hints & MAP_HINT_PREFETCH)
+			madvise(data, size, MADV_WILLNEED);
+#endif
 	}
 
 	~MemoryMappedFile()
 	{
-		UnmapViewOfFile(data);
-		CloseHandle(hmap);
-		CloseHandle(hfile);
+#ifdef WIN32
+		if (data != nullptr) {
+			UnmapViewOfFile(data);
+			CloseHandle(hmap);
+			CloseHandle(hfile);
+		}
+#else
+		if (data != nullptr)
+			munmap(data, size);
+#endif
 	}
 
+	MemoryMappedFile(const MemoryMappedFile &) = delete;
+	MemoryMappedFile &operator=(const MemoryMappedFile &) = delete;
+
 	const void *getData() const { return data; }
 	size_t getSize() const { return size; }
 
 private:
+#ifdef WIN32
 	HANDLE hfile;
 	HANDLE hmap;
+#endif
 	void *data;
 	size_t size;
 };
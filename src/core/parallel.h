@@ -0,0 +1,105 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+/*
+ * Splits [0, count) into contiguous ranges of at least minGrain items, and
+ * runs func on each range using all cores. The calling thread takes the
+ * last range, and small jobs run inline without spawning anything.
+ *
+ * Nested calls also run inline, as the outer call already uses all cores.
+ * If func throws, the other ranges still run to completion, and the first
+ * exception is rethrown on the calling thread.
+ */
+inline void parallelFor(int count, int minGrain, const std::function<void(int begin, int end)> &func)
+{
+	static thread_local bool insideParallelFor = false;
+
+	int maxThreads = std::max(int(std::thread::hardware_concurrency()), 1);
+	int threadCount = std::min(maxThreads, count / std::max(minGrain, 1));
+
+	if (threadCount <= 1 || insideParallelFor) {
+		if (count > 0)
+			func(0, count);
+		return;
+	}
+
+	std::mutex errorMutex;
+	std::exception_ptr error;
+
+	auto worker = [&](int begin, int end) {
+		struct NestingGuard {
+			NestingGuard() { insideParallelFor = true; }
+			~NestingGuard() { insideParallelFor = false; }
+		} nestingGuard;
+
+		try {
+			func(begin, end);
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(errorMutex);
+			if (!error)
+				error = std::current_exception();
+		}
+	};
+
+	std::vector<std::thread> threads;
+	threads.reserve(threadCount - 1);
+
+	int begin = 0;
+	for (int i = 0; i < threadCount - 1; ++i) {
+		int end = begin + count / threadCount + (i < count % threadCount ? 1 : 0);
+		try {
+			threads.emplace_back(worker, begin, end);
+		} catch (const std::system_error &) {
+			worker(begin, end); // out of threads, so run the range here
+		}
+		begin = end;
+	}
+	worker(begin, count);
+
+	for (auto &thread : threads)
+		thread.join();
+
+	if (error)
+		std::rethrow_exception(error);
+}
+
+// Bounds how much of a parallelFor is in flight at once
+class CountingSemaphore {
+public:
+	explicit CountingSemaphore(int count) : count(count) {}
+
+	CountingSemaphore(const CountingSemaphore &) = delete;
+	CountingSemaphore &operator=(const CountingSemaphore &) = delete;
+
+	void acquire()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		condition.wait(lock, [&] { return count > 0; });
+		--count;
+	}
+
+	void release()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			++count;
+		}
+		condition.notify_one();
+	}
+
+private:
+	std::mutex mutex;
+	std::condition_variable condition;
+	int count;
+};
+
+#endif // PARALLEL_H
@@ -0,0 +1,27 @@
+#ifndef REPLACEFILE_H
+#define REPLACEFILE_H
+
+#include <string>
+#include <cstdio>
+
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+/*
+ * Atomically replaces dst with src, for writing a file to a temporary
+ * path and then moving it into place. Readers see either the old or the
+ * new file, never none. Returns false on failure, leaving src in place.
+ */
+inline bool replaceFile(const std::string &src, const std::string &dst)
+{
+#ifdef WIN32
+	return MoveFileExA(src.c_str(), dst.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	// rename() replaces an existing dst atomically on POSIX
+	return rename(src.c_str(), dst.c_str()) == 0;
+#endif
+}
+
+#endif // REPLACEFILE_H
@@ -0,0 +1,205 @@
+#include "tlsf.h"
+#include "core.h"
+
+#include <cassert>
+#include <cstring>
+
+static int findHighestSet(uint64_t x)
+{
+	assert(x != 0);
+	auto high = uint32_t(x >> 32);
+	return high != 0 ? 63 - int(clz(high)) : 31 - int(clz(uint32_t(x)));
+}
+
+static int findLowestSet(uint64_t x)
+{
+	assert(x != 0);
+	return findHighestSet(x & (~x + 1));
+}
+
+static uint64_t alignOffset(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+TlsfAllocator::TlsfAllocator(uint64_t size) :
+	size(size),
+	usedSize(0),
+	freeRangeCount(0),
+	firstLevelBitmap(0)
+{
+	assert(size > 0 && size % TLSF_GRANULARITY == 0);
+
+	memset(secondLevelBitmaps, 0, sizeof(secondLevelBitmaps));
+	memset(freeLists, 0, sizeof(freeLists));
+
+	firstRange = new Range{ 0, size, nullptr, nullptr, nullptr, nullptr, true };
+	insertFreeRange(firstRange);
+}
+
+TlsfAllocator::~TlsfAllocator()
+{
+	auto range = firstRange;
+	while (range != nullptr) {
+		auto next = range->nextPhysical;
+		delete range;
+		range = next;
+	}
+}
+
+// The size class a range of this size is filed under
+void TlsfAllocator::mapping(uint64_t size, int *firstLevel, int *secondLevel)
+{
+	assert(size >= TLSF_GRANULARITY);
+	*firstLevel = findHighestSet(size);
+	*secondLevel = int((size >> (*firstLevel - SECOND_LEVEL_LOG2)) & (SECOND_LEVEL_COUNT - 1));
+}
+
+TlsfAllocator::Range *TlsfAllocator::findFreeRange(uint64_t size)
+{
+	// Rounding up to the next size class means any range found there fits,
+	// without walking a list
+	int firstLevel, secondLevel;
+	mapping(size + (uint64_t(1) << (findHighestSet(size) - SECOND_LEVEL_LOG2)) - 1, &firstLevel, &secondLevel);
+
+	auto secondLevelMap = secondLevelBitmaps[firstLevel] & (~0u << secondLevel);
+	if (secondLevelMap == 0) {
+		auto firstLevelMap = firstLevel + 1 < FIRST_LEVEL_COUNT ? firstLevelBitmap & (~uint64_t(0) << (firstLevel + 1)) : 0;
+		if (firstLevelMap != 0) {
+			firstLevel = findLowestSet(firstLevelMap);
+			secondLevelMap = secondLevelBitmaps[firstLevel];
+		}
+	}
+
+	if (secondLevelMap != 0)
+		return freeLists[firstLevel][findLowestSet(secondLevelMap)];
+
+	// the class the size itself falls in may still hold a range that fits
+	mapping(size, &firstLevel, &secondLevel);
+	for (auto range = freeLists[firstLevel][secondLevel]; range != nullptr; range = range->nextFree)
+		if (range->size >= size)
+			return range;
+
+	return nullptr;
+}
+
+void TlsfAllocator::insertFreeRange(Range *range)
+{
+	int firstLevel, secondLevel;
+	mapping(range->size, &firstLevel, &secondLevel);
+
+	auto &head = freeLists[firstLevel][secondLevel];
+	range->prevFree = nullptr;
+	range->nextFree = head;
+	if (head != nullptr)
+		head->prevFree = range;
+	head = range;
+
+	firstLevelBitmap |= uint64_t(1) << firstLevel;
+	secondLevelBitmaps[firstLevel] |= 1u << secondLevel;
+	++freeRangeCount;
+}
+
+void TlsfAllocator::removeFreeRange(Range *range)
+{
+	int firstLevel, secondLevel;
+	mapping(range->size, &firstLevel, &secondLevel);
+
+	if (range->prevFree != nullptr)
+		range->prevFree->nextFree = range->nextFree;
+	else
+		freeLists[firstLevel][secondLevel] = range->nextFree;
+
+	if (range->nextFree != nullptr)
+		range->nextFree->prevFree = range->prevFree;
+
+	if (freeLists[firstLevel][secondLevel] == nullptr) {
+		secondLevelBitmaps[firstLevel] &= ~(1u << secondLevel);
+		if (secondLevelBitmaps[firstLevel] == 0)
+			firstLevelBitmap &= ~(uint64_t(1) << firstLevel);
+	}
+	--freeRangeCount;
+}
+
+// Shrinks range to size, and returns a new free range for the rest of it
+TlsfAllocator::Range *TlsfAllocator::splitRange(Range *range, uint64_t size)
+{
+	assert(size < range->size);
+
+	auto rest = new Range{ range->offset + size, range->size - size, range, range->nextPhysical, nullptr, nullptr, true };
+	if (range->nextPhysical != nullptr)
+		range->nextPhysical->prevPhysical = rest;
+	range->nextPhysical = rest;
+	range->size = size;
+	return rest;
+}
+
+void TlsfAllocator::mergeWithNext(Range *range)
+{
+	auto next = range->nextPhysical;
+	range->size += next->size;
+	range->nextPhysical = next->nextPhysical;
+	if (next->nextPhysical != nullptr)
+		next->nextPhysical->prevPhysical = range;
+	delete next;
+}
+
+bool TlsfAllocator::allocate(uint64_t allocationSize, uint64_t alignment, uint64_t *offset)
+{
+	assert(allocationSize > 0);
+	assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+	assert(offset != nullptr);
+
+	allocationSize = alignOffset(allocationSize, TLSF_GRANULARITY);
+	alignment = alignment > TLSF_GRANULARITY ? alignment : TLSF_GRANULARITY;
+	if (allocationSize > size)
+		return false;
+
+	// ranges always start on the granularity, so only larger alignments need room for padding
+	auto range = findFreeRange(allocationSize + alignment - TLSF_GRANULARITY);
+	if (range == nullptr)
+		return false;
+	removeFreeRange(range);
+
+	// free ranges never neighbour each other, so the padding and the rest can't be merged
+	auto padding = alignOffset(range->offset, alignment) - range->offset;
+	if (padding > 0) {
+		auto aligned = splitRange(range, padding);
+		insertFreeRange(range);
+		range = aligned;
+	}
+
+	if (range->size > allocationSize)
+		insertFreeRange(splitRange(range, allocationSize));
+
+	range->free = false;
+	usedRanges[range->offset] = range;
+	usedSize += range->size;
+	*offset = range->offset;
+	return true;
+}
+
+void TlsfAllocator::free(uint64_t offset)
+{
+	auto it = usedRanges.find(offset);
+	assert(it != usedRanges.end());
+	auto range = it->second;
+	usedRanges.erase(it);
+
+	usedSize -= range->size;
+	range->free = true;
+
+	if (range->nextPhysical != nullptr && range->nextPhysical->free) {
+		removeFreeRange(range->nextPhysical);
+		mergeWithNext(range);
+	}
+
+	if (range->prevPhysical != nullptr && range->prevPhysical->free) {
+		auto prev = range->prevPhysical;
+		removeFreeRange(prev);
+		mergeWithNext(prev);
+		range = prev;
+	}
+
+	insertFreeRange(range);
+}
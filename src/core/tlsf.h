@@ -0,0 +1,69 @@
+#ifndef TLSF_H
+#define TLSF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+
+/*
+ * Two-level segregated fit allocator over the offsets of a range it doesn't
+ * own, like a block of device memory. Free ranges are kept in size classes
+ * of a power of two, split into 16 linear steps, so finding a fitting
+ * range and freeing one are constant time. Neighbouring free ranges are
+ * merged right away.
+ *
+ * All offsets and sizes are multiples of TLSF_GRANULARITY.
+ */
+#define TLSF_GRANULARITY 256
+
+class TlsfAllocator {
+public:
+	explicit TlsfAllocator(uint64_t size);
+	~TlsfAllocator();
+
+	TlsfAllocator(const TlsfAllocator &) = delete;
+	TlsfAllocator &operator=(const TlsfAllocator &) = delete;
+
+	// alignment must be a power of two. Returns false if nothing fits.
+	bool allocate(uint64_t size, uint64_t alignment, uint64_t *offset);
+	void free(uint64_t offset);
+
+	uint64_t getSize() const { return size; }
+	uint64_t getUsedSize() const { return usedSize; }
+	size_t getAllocationCount() const { return usedRanges.size(); }
+	size_t getFreeRangeCount() const { return freeRangeCount; }
+	bool empty() const { return usedRanges.empty(); }
+
+private:
+	enum {
+		SECOND_LEVEL_LOG2 = 4,
+		SECOND_LEVEL_COUNT = 1 << SECOND_LEVEL_LOG2,
+		FIRST_LEVEL_COUNT = 64
+	};
+
+	struct Range {
+		uint64_t offset, size;
+		Range *prevPhysical, *nextPhysical;
+		Range *prevFree, *nextFree;
+		bool free;
+	};
+
+	static void mapping(uint64_t size, int *firstLevel, int *secondLevel);
+	Range *findFreeRange(uint64_t size);
+	void insertFreeRange(Range *range);
+	void removeFreeRange(Range *range);
+	Range *splitRange(Range *range, uint64_t size);
+	void mergeWithNext(Range *range);
+
+	uint64_t size, usedSize;
+	size_t freeRangeCount;
+
+	Range *firstRange;
+	std::unordered_map<uint64_t, Range *> usedRanges;
+
+	uint64_t firstLevelBitmap;
+	uint32_t secondLevelBitmaps[FIRST_LEVEL_COUNT];
+	Range *freeLists[FIRST_LEVEL_COUNT][SECOND_LEVEL_COUNT];
+};
+
+#endif // TLSF_H
@@ -0,0 +1,239 @@
+#include "framecontext.h"
+#include "swapchain.h"
+#include "core/parallel.h"
+
+using namespace vulkan;
+
+using std::vector;
+
+static int getWorkerCount()
+{
+	return std::max(int(std::thread::hardware_concurrency()), 1);
+}
+
+static int getRangeCount(int count, int minGrain)
+{
+	assert(minGrain > 0);
+	return std::min(getWorkerCount(), (count + minGrain - 1) / minGrain);
+}
+
+// Records [0, count) split evenly into rangeCount secondary command buffers, each on its own thread
+static void recordRanges(const VkCommandBuffer *commandBuffers, int rangeCount, int count,
+                         VkRenderPass renderPass, uint32_t subpass, VkFramebuffer framebuffer,
+                         VkCommandBufferUsageFlags usageFlags, const SecondaryRecorder &record)
+{
+	VkCommandBufferInheritanceInfo inheritanceInfo = {};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.renderPass = renderPass;
+	inheritanceInfo.subpass = subpass;
+	inheritanceInfo.framebuffer = framebuffer;
+
+	VkCommandBufferBeginInfo commandBufferBeginInfo = {};
+	commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	commandBufferBeginInfo.flags = usageFlags;
+	if (renderPass != VK_NULL_HANDLE)
+		commandBufferBeginInfo.flags |= VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	commandBufferBeginInfo.pInheritanceInfo = &inheritanceInfo;
+
+	parallelFor(rangeCount, 1, [&](int beginRange, int endRange) {
+		for (auto range = beginRange; range < endRange; ++range) {
+			auto commandBuffer = commandBuffers[range];
+
+			VkResult err = vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo);
+			assert(err == VK_SUCCESS);
+
+			record(commandBuffer,
+			       int(int64_t(count) * range / rangeCount),
+			       int(int64_t(count) * (range + 1) / rangeCount));
+
+			err = vkEndCommandBuffer(commandBuffer);
+			assert(err == VK_SUCCESS);
+		}
+	});
+}
+
+FrameQueue::FrameQueue(SwapChain &swapChain, int framesInFlight, VkDeviceSize uniformFrameSize) :
+	swapChain(swapChain),
+	uniforms(uniformFrameSize, framesInFlight),
+	frameNumber(0),
+	recording(false),
+	recordedParallel(false)
+{
+	assert(framesInFlight > 0);
+
+	frames.resize(framesInFlight);
+	for (auto i = 0; i < framesInFlight; ++i) {
+		auto &frame = frames[i];
+		frame.index = i;
+		frame.swapImage = UINT32_MAX;
+		frame.commandPool = createCommandPool(graphicsQueueFamily);
+		frame.commandBuffer = allocateCommandBuffers(frame.commandPool, 1)[0];
+		frame.imageAcquiredSemaphore = createSemaphore();
+		frame.renderCompleteSemaphore = createSemaphore();
+		frame.fence = createFence(VK_FENCE_CREATE_SIGNALED_BIT);
+	}
+}
+
+FrameQueue::~FrameQueue()
+{
+	assert(!recording);
+
+	for (auto &frame : frames) {
+		VkResult err = vkWaitForFences(device, 1, &frame.fence, VK_TRUE, UINT64_MAX);
+		assert(err == VK_SUCCESS);
+
+		vkDestroyFence(device, frame.fence, nullptr);
+		vkDestroySemaphore(device, frame.renderCompleteSemaphore, nullptr);
+		vkDestroySemaphore(device, frame.imageAcquiredSemaphore, nullptr);
+		vkDestroyCommandPool(device, frame.commandPool, nullptr);
+		for (auto commandPool : frame.workerCommandPools)
+			vkDestroyCommandPool(device, commandPool, nullptr);
+	}
+}
+
+FrameContext &FrameQueue::beginFrame()
+{
+	assert(!recording);
+	auto &frame = frames[frameNumber % frames.size()];
+
+	VkResult err = vkWaitForFences(device, 1, &frame.fence, VK_TRUE, UINT64_MAX);
+	assert(err == VK_SUCCESS);
+
+	err = vkResetFences(device, 1, &frame.fence);
+	assert(err == VK_SUCCESS);
+
+	// the whole pool at once, rather than command buffer by command buffer
+	err = vkResetCommandPool(device, frame.commandPool, 0);
+	assert(err == VK_SUCCESS);
+	for (auto commandPool : frame.workerCommandPools) {
+		err = vkResetCommandPool(device, commandPool, 0);
+		assert(err == VK_SUCCESS);
+	}
+
+	frame.swapImage = swapChain.aquireNextImage(frame.imageAcquiredSemaphore);
+
+	VkCommandBufferBeginInfo commandBufferBeginInfo = {};
+	commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	err = vkBeginCommandBuffer(frame.commandBuffer, &commandBufferBeginInfo);
+	assert(err == VK_SUCCESS);
+
+	uniforms.beginFrame(frame.index);
+
+	recording = true;
+	recordedParallel = false;
+	return frame;
+}
+
+void FrameQueue::recordParallel(VkRenderPass renderPass, uint32_t subpass, VkFramebuffer framebuffer, int count, int minGrain,
+                                const SecondaryRecorder &record)
+{
+	assert(recording && !recordedParallel);
+	auto &frame = frames[frameNumber % frames.size()];
+	recordedParallel = true;
+
+	if (count <= 0)
+		return;
+
+	// on first use, so frames that never record in parallel don't reset the pools every frame
+	if (frame.workerCommandPools.empty()) {
+		for (auto i = 0; i < getWorkerCount(); ++i) {
+			auto commandPool = createCommandPool(graphicsQueueFamily);
+			frame.workerCommandPools.push_back(commandPool);
+			frame.workerCommandBuffers.push_back(allocateCommandBuffers(commandPool, 1, VK_COMMAND_BUFFER_LEVEL_SECONDARY)[0]);
+		}
+	}
+
+	// one range per worker command buffer, so no two threads share a pool
+	auto rangeCount = getRangeCount(count, minGrain);
+	recordRanges(frame.workerCommandBuffers.data(), rangeCount, count,
+	             renderPass, subpass, framebuffer,
+	             VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT, record);
+
+	vkCmdExecuteCommands(frame.commandBuffer, uint32_t(rangeCount), frame.workerCommandBuffers.data());
+}
+
+void FrameQueue::endFrame(VkPipelineStageFlags waitStage)
+{
+	assert(recording);
+	auto &frame = frames[frameNumber % frames.size()];
+
+	uniforms.endFrame();
+
+	VkResult err = vkEndCommandBuffer(frame.commandBuffer);
+	assert(err == VK_SUCCESS);
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.waitSemaphoreCount = 1;
+	submitInfo.pWaitSemaphores = &frame.imageAcquiredSemaphore;
+	submitInfo.pWaitDstStageMask = &waitStage;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &frame.commandBuffer;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &frame.renderCompleteSemaphore;
+
+	err = vkQueueSubmit(graphicsQueue, 1, &submitInfo, frame.fence);
+	assert(err == VK_SUCCESS);
+
+	swapChain.queuePresent(frame.swapImage, &frame.renderCompleteSemaphore, 1);
+
+	++frameNumber;
+	recording = false;
+}
+
+StaticSegment::StaticSegment(int framesInFlight) :
+	recordCount(0)
+{
+	assert(framesInFlight > 0);
+
+	// the buffers of a frame are indexed by range, so they come from different pools
+	auto workerCount = getWorkerCount();
+	commandBuffers.resize(framesInFlight);
+	for (auto i = 0; i < workerCount; ++i) {
+		auto commandPool = createCommandPool(graphicsQueueFamily);
+		commandPools.push_back(commandPool);
+
+		auto poolCommandBuffers = allocateCommandBuffers(commandPool, framesInFlight, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+		for (auto j = 0; j < framesInFlight; ++j)
+			commandBuffers[j].push_back(poolCommandBuffers[j]);
+	}
+
+	recordings.resize(framesInFlight, { false, 0, 0 });
+}
+
+StaticSegment::~StaticSegment()
+{
+	for (auto commandPool : commandPools)
+		vkDestroyCommandPool(device, commandPool, nullptr);
+}
+
+void StaticSegment::invalidate()
+{
+	for (auto &recording : recordings)
+		recording.valid = false;
+}
+
+void StaticSegment::execute(const FrameContext &frame, uint64_t key, VkRenderPass renderPass, uint32_t subpass, VkFramebuffer framebuffer,
+                            int count, int minGrain, const SecondaryRecorder &record)
+{
+	assert(frame.index >= 0 && frame.index < int(recordings.size()));
+	auto &recording = recordings[frame.index];
+	auto &frameCommandBuffers = commandBuffers[frame.index];
+
+	// the frame's fence has signaled, so its buffers are no longer pending and may be re-recorded
+	if (!recording.valid || recording.key != key) {
+		recording.rangeCount = count > 0 ? getRangeCount(count, minGrain) : 0;
+		if (recording.rangeCount > 0)
+			recordRanges(frameCommandBuffers.data(), recording.rangeCount, count,
+			             renderPass, subpass, framebuffer, 0, record);
+
+		recording.valid = true;
+		recording.key = key;
+		++recordCount;
+	}
+
+	if (recording.rangeCount > 0)
+		vkCmdExecuteCommands(frame.commandBuffer, uint32_t(recording.rangeCount), frameCommandBuffers.data());
+}
@@ -0,0 +1,120 @@
+#ifndef FRAMECONTEXT_H
+#define FRAMECONTEXT_H
+
+#include "vkinstance.h"
+#include "scene/uniform-ring.h"
+
+#include <functional>
+#include <vector>
+
+class SwapChain;
+
+// records commands for items [begin, end) into a secondary command buffer
+typedef std::function<void(VkCommandBuffer commandBuffer, int begin, int end)> SecondaryRecorder;
+
+// Everything one frame in flight records and submits with
+struct FrameContext {
+	int index;
+	uint32_t swapImage;
+
+	VkCommandPool commandPool;
+	VkCommandBuffer commandBuffer;
+
+	// a pool per worker, as pools can't be used from several threads at once;
+	// created by the first FrameQueue::recordParallel() for this frame
+	std::vector<VkCommandPool> workerCommandPools;
+	std::vector<VkCommandBuffer> workerCommandBuffers;
+
+	VkSemaphore imageAcquiredSemaphore, renderCompleteSemaphore;
+	VkFence fence; // signaled once the GPU is done with the frame
+};
+
+/*
+ * A fixed number of frames in flight, independent of how many images the
+ * swap chain has. A frame's command pool, semaphores and uniform region
+ * are only reused once the frame that last used them has finished, so
+ * the CPU records the next frame while the GPU works on the previous one.
+ */
+class FrameQueue {
+public:
+	FrameQueue(SwapChain &swapChain, int framesInFlight, VkDeviceSize uniformFrameSize);
+	~FrameQueue();
+
+	FrameQueue(const FrameQueue &) = delete;
+	FrameQueue &operator=(const FrameQueue &) = delete;
+
+	// Waits for the frame that used these resources last, acquires a swap
+	// chain image, and begins the command buffer and the uniform region
+	FrameContext &beginFrame();
+
+	// Splits [0, count) into ranges of at least minGrain items, records
+	// each into a secondary command buffer on its own thread, and executes
+	// them in order. Call inside a render pass begun with
+	// VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS; record() starts from
+	// no bound state, so it has to bind and set everything it uses. The
+	// secondary command buffers are reused, so call this once per frame.
+	void recordParallel(VkRenderPass renderPass, uint32_t subpass, VkFramebuffer framebuffer, int count, int minGrain,
+	                    const SecondaryRecorder &record);
+
+	// Submits the command buffer, waiting for the swap chain image at
+	// waitStage, and presents the image
+	void endFrame(VkPipelineStageFlags waitStage);
+
+	UniformRing &getUniforms() { return uniforms; }
+	int getFramesInFlight() const { return int(frames.size()); }
+
+private:
+	SwapChain &swapChain;
+	std::vector<FrameContext> frames;
+	UniformRing uniforms;
+
+	uint64_t frameNumber;
+	bool recording, recordedParallel;
+};
+
+/*
+ * Secondary command buffers recorded once and replayed every frame, for
+ * parts of a frame whose commands stay the same while only the contents
+ * of buffers they read change. There is a set per frame in flight, as
+ * dynamic uniform offsets differ between the frames' regions; so each
+ * frame has to push its uniforms in the same order for the offsets to
+ * stay valid.
+ */
+class StaticSegment {
+public:
+	explicit StaticSegment(int framesInFlight);
+	~StaticSegment();
+
+	StaticSegment(const StaticSegment &) = delete;
+	StaticSegment &operator=(const StaticSegment &) = delete;
+
+	// re-record on the next execute() of every frame, e.g. after a pipeline was rebuilt
+	void invalidate();
+
+	// Executes what was recorded for this frame. Records it first like
+	// FrameQueue::recordParallel() does, if key differs from the one it was
+	// recorded with, or after invalidate(). Pass something that changes
+	// with whatever the commands depend on, like Scene::getStructureVersion().
+	// Outside render passes, pass VK_NULL_HANDLE as renderPass and framebuffer.
+	void execute(const FrameContext &frame, uint64_t key, VkRenderPass renderPass, uint32_t subpass, VkFramebuffer framebuffer,
+	             int count, int minGrain, const SecondaryRecorder &record);
+
+	// times execute() had to record, for checking that the segment really is static
+	uint64_t getRecordCount() const { return recordCount; }
+
+private:
+	struct Recording {
+		bool valid;
+		uint64_t key;
+		int rangeCount;
+	};
+
+	// per worker, and within each, one command buffer per frame in flight
+	std::vector<VkCommandPool> commandPools;
+	std::vector<std::vector<VkCommandBuffer>> commandBuffers;
+
+	std::vector<Recording> recordings;
+	uint64_t recordCount;
+};
+
+#endif // FRAMECONTEXT_H
@@ -7,15 +7,27 @@
 #define _USE_MATH_DEFINES
 #include <cmath>
 #include <algorithm>
+#include <initializer_list>
 #include <list>
 #include <map>
+#include <memory>
 #include <stdexcept>
+#include <cstring>
+
+#include <sys/stat.h>
 
 #include "vkinstance.h"
 #include "core/core.h"
+#include "core/assetpack.h"
+#include "core/hash.h"
+#include "core/memorymappedfile.h"
 #include "swapchain.h"
+#include "framecontext.h"
 #include "shader.h"
+#include "pipelinecompiler.h"
 #include "scene/import-texture.h"
+#include "scene/upload-batch.h"
+#include "scene/color-grade.h"
 
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include <GLFW/glfw3.h>
@@ -27,6 +39,9 @@ using namespace vulkan;
 
 using std::vector;
 using std::map;
+using std::string;
+using std::unique_ptr;
+using std::make_unique;
 using std::exception;
 using std::runtime_error;
 using glm::vec2;
@@ -43,96 +58,11 @@ static vector<const char *> getRequiredInstanceExtensions()
 #include "scene/scene.h"
 #include "scene/rendertarget.h"
 
-static VkPipeline createGraphicsPipeline(const ShaderProgram &shaderProgram, VkRenderPass renderPass, const VkPipelineVertexInputStateCreateInfo &pipelineVertexInputStateCreateInfo)
+// A StaticSegment key covering everything the segment's commands bake in,
+// so replacing any of it re-records the segment. Handles go in as numbers.
+static uint64_t getSegmentKey(std::initializer_list<uint64_t> values)
 {
-	VkPipelineInputAssemblyStateCreateInfo pipelineInputAssemblyStateCreateInfo = {};
-	pipelineInputAssemblyStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-	pipelineInputAssemblyStateCreateInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-	pipelineInputAssemblyStateCreateInfo.primitiveRestartEnable = VK_FALSE;
-
-	VkPipelineRasterizationStateCreateInfo pipelineRasterizationStateCreateInfo = {};
-	pipelineRasterizationStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-	pipelineRasterizationStateCreateInfo.polygonMode = VK_POLYGON_MODE_FILL;
-	pipelineRasterizationStateCreateInfo.cullMode = VK_CULL_MODE_BACK_BIT;
-	pipelineRasterizationStateCreateInfo.frontFace = VK_FRONT_FACE_CLOCKWISE;
-	pipelineRasterizationStateCreateInfo.lineWidth = 1.0f;
-
-	VkPipelineColorBlendAttachmentState pipelineColorBlendAttachmentState[1] = { { 0 } };
-	pipelineColorBlendAttachmentState[0].colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-	pipelineColorBlendAttachmentState[0].blendEnable = VK_FALSE;
-
-	VkPipelineColorBlendStateCreateInfo pipelineColorBlendStateCreateInfo = {};
-	pipelineColorBlendStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-	pipelineColorBlendStateCreateInfo.attachmentCount = ARRAY_SIZE(pipelineColorBlendAttachmentState);
-	pipelineColorBlendStateCreateInfo.pAttachments = pipelineColorBlendAttachmentState;
-
-	VkPipelineMultisampleStateCreateInfo pipelineMultisampleStateCreateInfo = {};
-	pipelineMultisampleStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-	pipelineMultisampleStateCreateInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-
-	VkPipelineViewportStateCreateInfo pipelineViewportStateCreateInfo = {};
-	pipelineViewportStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-	pipelineViewportStateCreateInfo.viewportCount = 1;
-	pipelineViewportStateCreateInfo.pViewports = nullptr;
-	pipelineViewportStateCreateInfo.scissorCount = 1;
-	pipelineViewportStateCreateInfo.pScissors = nullptr;
-
-	VkPipelineDepthStencilStateCreateInfo pipelineDepthStencilStateCreateInfo = {};
-	pipelineDepthStencilStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-	pipelineDepthStencilStateCreateInfo.depthTestEnable = VK_TRUE;
-	pipelineDepthStencilStateCreateInfo.depthWriteEnable = VK_TRUE;
-	pipelineDepthStencilStateCreateInfo.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
-
-	VkDynamicState dynamicStateEnables[] = {
-		VK_DYNAMIC_STATE_VIEWPORT,
-		VK_DYNAMIC_STATE_SCISSOR
-	};
-
-	VkPipelineDynamicStateCreateInfo pipelineDynamicStateCreateInfo = {};
-	pipelineDynamicStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-	pipelineDynamicStateCreateInfo.pDynamicStates = dynamicStateEnables;
-	pipelineDynamicStateCreateInfo.dynamicStateCount = ARRAY_SIZE(dynamicStateEnables);
-
-	VkGraphicsPipelineCreateInfo pipelineCreateInfo = {};
-	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-	pipelineCreateInfo.layout = shaderProgram.getPipelineLayout();
-	pipelineCreateInfo.renderPass = renderPass;
-	pipelineCreateInfo.pVertexInputState = &pipelineVertexInputStateCreateInfo;
-	pipelineCreateInfo.pInputAssemblyState = &pipelineInputAssemblyStateCreateInfo;
-	pipelineCreateInfo.pRasterizationState = &pipelineRasterizationStateCreateInfo;
-	pipelineCreateInfo.pColorBlendState = &pipelineColorBlendStateCreateInfo;
-	pipelineCreateInfo.pMultisampleState = &pipelineMultisampleStateCreateInfo;
-	pipelineCreateInfo.pViewportState = &pipelineViewportStateCreateInfo;
-	pipelineCreateInfo.pDepthStencilState = &pipelineDepthStencilStateCreateInfo;
-	pipelineCreateInfo.pDynamicState = &pipelineDynamicStateCreateInfo;
-
-	auto shaderStages = shaderProgram.getPipelineShaderStageCreateInfos();
-	pipelineCreateInfo.stageCount = shaderStages.size();
-	pipelineCreateInfo.pStages = shaderStages.data();
-
-	VkPipeline pipeline;
-	auto err = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &pipeline);
-	assert(err == VK_SUCCESS);
-
-	return pipeline;
-}
-
-static VkPipeline createComputePipeline(const ShaderProgram &shaderProgram)
-{
-	VkComputePipelineCreateInfo computePipelineCreateInfo = {};
-	computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-
-	auto stages = shaderProgram.getPipelineShaderStageCreateInfos();
-	assert(stages.size() == 1);
-	assert(stages[0].stage == VK_SHADER_STAGE_COMPUTE_BIT);
-
-	computePipelineCreateInfo.stage = stages[0];
-	computePipelineCreateInfo.layout = shaderProgram.getPipelineLayout();
-
-	VkPipeline computePipeline;
-	auto err = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &computePipeline);
-	assert(err == VK_SUCCESS);
-	return computePipeline;
+	return hash64(values.begin(), values.size() * sizeof(uint64_t));
 }
 
 namespace CubeData
@@ -196,6 +126,34 @@ namespace CubeData
 	};
 }
 
+static const char *assetPackPath = "data/assets.pack";
+
+static bool fileExists(const string &path)
+{
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 && (st.st_mode & S_IFMT) == S_IFREG;
+}
+
+static void cookAssets(const string &path)
+{
+	AssetPackWriter writer;
+	cookTexture2D(writer, "excess-logo", "assets/excess-logo.png", TextureImportFlags::GENERATE_MIPMAPS);
+	cookCubeFile(writer, "color-lut", "assets/color-lut.CUBE", VK_FORMAT_A2B10G10R10_UNORM_PACK32);
+
+	const char *shaders[] = {
+		"triangle.vert.spv",
+		"triangle.frag.spv",
+		"postprocess.comp.spv",
+		"lut-bake.comp.spv",
+	};
+	for (auto shader : shaders) {
+		MemoryMappedFile shaderCode(string("data/shaders/") + shader, MAP_HINT_SEQUENTIAL);
+		writer.addBlob(shader, shaderCode.getData(), shaderCode.getSize());
+	}
+
+	writer.write(path);
+}
+
 VkPhysicalDevice choosePhysicalDevice()
 {
 	// Get number of available physical devices
@@ -236,11 +194,20 @@ int APIENTRY WinMain(_In_ HINSTANCE hInstance,
 {
 	UNREFERENCED_PARAMETER(hInstance);
 	UNREFERENCED_PARAMETER(hPrevInstance);
-	UNREFERENCED_PARAMETER(lpCmdLine);
 	UNREFERENCED_PARAMETER(nCmdShow);
+
+	auto cook = strcmp(lpCmdLine, "--cook") == 0;
+	auto usePack = strcmp(lpCmdLine, "--pack") == 0;
 #else
 int main(int argc, char *argv[])
 {
+	auto cook = argc > 1 && strcmp(argv[1], "--cook") == 0;
+	auto usePack = argc > 1 && strcmp(argv[1], "--pack") == 0;
+#endif
+
+#ifdef USE_ASSET_PACK
+	// release builds ship with a cooked pack, and nothing else
+	usePack = true;
 #endif
 
 	auto appName = "some excess demo";
@@ -249,6 +216,12 @@ int main(int argc, char *argv[])
 	GLFWwindow *win = nullptr;
 
 	try {
+		if (cook) {
+			// bake all assets into a pack, that later runs load without decoding
+			cookAssets(assetPackPath);
+			return 0;
+		}
+
 		if (!glfwInit())
 			throw runtime_error("glfwInit failed!");
 
@@ -277,7 +250,7 @@ int main(int argc, char *argv[])
 		auto physicalDevice = choosePhysicalDevice();
 		deviceInit(physicalDevice, [](VkInstance instance, VkPhysicalDevice physicalDevice, uint32_t queueFamily) {
 			return glfwGetPhysicalDevicePresentationSupport(instance, physicalDevice, queueFamily) == GLFW_TRUE;
-		});
+		}, "data/pipelines.cache");
 
 		VkSurfaceKHR surface;
 		auto err = glfwCreateWindowSurface(instance, win, nullptr, &surface);
@@ -379,37 +352,46 @@ int main(int argc, char *argv[])
 
 		// OK, let's prepare for rendering!
 
-		auto texture = importTexture2D("assets/excess-logo.png", TextureImportFlags::GENERATE_MIPMAPS);
-		auto colorLut = importCubeFile("assets/color-lut.CUBE");
+		// Only on request, as the pack doesn't notice when the source assets
+		// change; loading it by default would hide edits behind a stale copy
+		unique_ptr<AssetPack> assetPack;
+		if (usePack) {
+			if (!fileExists(assetPackPath))
+				throw runtime_error("no asset pack, run with --cook first!");
+			assetPack = make_unique<AssetPack>(assetPackPath);
+		}
+
+		auto loadShader = [&](const string &name) {
+			return assetPack ? loadShaderModule(*assetPack, name) : loadShaderModule("data/shaders/" + name);
+		};
+
+		// record all startup uploads, and submit them in one go
+		UploadBatch uploads;
+		setTextureUploadBatch(&uploads);
+
+		auto texture = assetPack ? importTexture2D(*assetPack, "excess-logo") : importTexture2D("assets/excess-logo.png", TextureImportFlags::GENERATE_MIPMAPS);
+		auto colorLut = assetPack ? importTexture3D(*assetPack, "color-lut") : importCubeFile("assets/color-lut.CUBE", { VK_FORMAT_A2B10G10R10_UNORM_PACK32 });
 
 		auto shaderProgram = ShaderProgram({
-			ShaderStage(VK_SHADER_STAGE_VERTEX_BIT, loadShaderModule("data/shaders/triangle.vert.spv")),
-			ShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, loadShaderModule("data/shaders/triangle.frag.spv"))
+			ShaderStage(VK_SHADER_STAGE_VERTEX_BIT, loadShader("triangle.vert.spv")),
+			ShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, loadShader("triangle.frag.spv"))
 		}, {
-			{ 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1, VK_SHADER_STAGE_VERTEX_BIT },
-			{ 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT }
+			// the rest of the layout comes from the shaders
+			{ 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1, VK_SHADER_STAGE_VERTEX_BIT }
 		});
-		auto pipelineLayout = createPipelineLayout({ shaderProgram.getDescriptorSetLayout() }, {});
-
-		VkVertexInputBindingDescription vertexInputBindingDesc[1];
-		vertexInputBindingDesc[0].binding = 0;
-		vertexInputBindingDesc[0].stride = sizeof(float) * 3;
-		vertexInputBindingDesc[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
-		VkVertexInputAttributeDescription vertexInputAttributeDescription[1];
-		vertexInputAttributeDescription[0].binding = 0;
-		vertexInputAttributeDescription[0].location = 0;
-		vertexInputAttributeDescription[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-		vertexInputAttributeDescription[0].offset = 0;
+		auto postProcessShaderProgram = ShaderProgram({
+			ShaderStage(VK_SHADER_STAGE_COMPUTE_BIT, loadShader("postprocess.comp.spv"))
+		});
 
-		VkPipelineVertexInputStateCreateInfo pipelineVertexInputStateCreateInfo = {};
-		pipelineVertexInputStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-		pipelineVertexInputStateCreateInfo.vertexBindingDescriptionCount = ARRAY_SIZE(vertexInputBindingDesc);
-		pipelineVertexInputStateCreateInfo.pVertexBindingDescriptions = vertexInputBindingDesc;
-		pipelineVertexInputStateCreateInfo.vertexAttributeDescriptionCount = ARRAY_SIZE(vertexInputAttributeDescription);
-		pipelineVertexInputStateCreateInfo.pVertexAttributeDescriptions = vertexInputAttributeDescription;
+		GraphicsPipelineDesc pipelineDesc(shaderProgram, renderPass);
+		pipelineDesc.vertexBindings.push_back({ 0, sizeof(float) * 3, VK_VERTEX_INPUT_RATE_VERTEX });
+		pipelineDesc.vertexAttributes.push_back({ 0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0 });
 
-		auto pipeline = createGraphicsPipeline(shaderProgram, renderPass, pipelineVertexInputStateCreateInfo);
+		// compile while the uploads are recorded; declared after the programs, so it finishes before they go
+		PipelineCompiler pipelineCompiler;
+		auto pipelineFuture = pipelineCompiler.compile(pipelineDesc);
+		auto postProcessPipelineFuture = pipelineCompiler.compile(postProcessShaderProgram);
 
 		auto descriptorPool = createDescriptorPool({
 			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1 },
@@ -420,14 +402,15 @@ int main(int argc, char *argv[])
 			mat4 modelViewProjectionMatrix;
 		} perObjectUniforms;
 		auto uniformSize = sizeof(perObjectUniforms);
-		auto uniformBufferSpacing = uint32_t(alignSize(uniformSize, deviceProperties.limits.minUniformBufferOffsetAlignment));
-		auto uniformBufferSize = VkDeviceSize(uniformBufferSpacing * scene.getTransforms().size());
+		auto uniformBufferSpacing = alignSize(uniformSize, deviceProperties.limits.minUniformBufferOffsetAlignment);
 
-		auto uniformBuffer = UniformBuffer(uniformBufferSize);
+		// the CPU records one frame while the GPU renders the previous one
+		FrameQueue frameQueue(swapChain, 2, uniformBufferSpacing * scene.getTransforms().size());
+		auto &uniformRing = frameQueue.getUniforms();
 
 		auto descriptorSet = allocateDescriptorSet(descriptorPool, shaderProgram.getDescriptorSetLayout());
 
-		VkDescriptorBufferInfo descriptorBufferInfo = uniformBuffer.getDescriptorBufferInfo();
+		VkDescriptorBufferInfo descriptorBufferInfo = uniformRing.getDescriptorBufferInfo(uniformSize);
 
 		VkWriteDescriptorSet writeDescriptorSets[2] = {};
 		writeDescriptorSets[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
@@ -450,26 +433,27 @@ int main(int argc, char *argv[])
 		writeDescriptorSets[1].dstBinding = 1;
 		vkUpdateDescriptorSets(device, ARRAY_SIZE(writeDescriptorSets), writeDescriptorSets, 0, nullptr);
 
-		auto vertexStagingBuffer = StagingBuffer(sizeof(CubeData::vertexPositions));
-		vertexStagingBuffer.uploadMemory(0, CubeData::vertexPositions, sizeof(CubeData::vertexPositions));
+		auto vertexStaging = uploads.allocateStaging(sizeof(CubeData::vertexPositions));
+		memcpy(vertexStaging.data, CubeData::vertexPositions, sizeof(CubeData::vertexPositions));
 
 		auto vertexBuffer = VertexBuffer(sizeof(CubeData::vertexPositions));
-		vertexBuffer.uploadFromStagingBuffer(vertexStagingBuffer, 0, 0, sizeof(CubeData::vertexPositions));
+		uploads.copyBuffer(vertexStaging, &vertexBuffer);
 
-		auto indexStagingBuffer = StagingBuffer(sizeof(CubeData::vertexIndices));
-		indexStagingBuffer.uploadMemory(0, CubeData::vertexIndices, sizeof(CubeData::vertexIndices));
+		auto indexStaging = uploads.allocateStaging(sizeof(CubeData::vertexIndices));
+		memcpy(indexStaging.data, CubeData::vertexIndices, sizeof(CubeData::vertexIndices));
 
 		auto indexBuffer = IndexBuffer(sizeof(CubeData::vertexIndices));
-		indexBuffer.uploadFromStagingBuffer(indexStagingBuffer, 0, 0, sizeof(CubeData::vertexIndices));
+		uploads.copyBuffer(indexStaging, &indexBuffer);
 
-		auto postProcessShaderProgram = ShaderProgram({
-			ShaderStage(VK_SHADER_STAGE_COMPUTE_BIT, loadShaderModule("data/shaders/postprocess.comp.spv"))
-		}, {
-			ShaderDescriptor(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT),
-			ShaderDescriptor(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT),
-			ShaderDescriptor(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT),
-		});
-		auto postProcessPipeline = createComputePipeline(postProcessShaderProgram);
+		setTextureUploadBatch(nullptr);
+		uploads.submit();
+
+		// bakes the grading stack into the LUT that post-processing samples
+		ColorGrade colorGrade(loadShader("lut-bake.comp.spv"));
+		auto colorLutIndex = colorGrade.addLut(colorLut.get());
+
+		auto pipeline = pipelineFuture.get();
+		auto postProcessPipeline = postProcessPipelineFuture.get();
 
 		auto postProcessDescriptorPool = createDescriptorPool({
 			{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1 },
@@ -492,7 +476,7 @@ int main(int argc, char *argv[])
 
 			vector<VkDescriptorImageInfo> descriptorImageInfos = {
 				{ textureSampler, colorRenderTarget.getImageView(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL },
-				{ colorLutSampler, colorLut->getImageView(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL }
+				{ colorLutSampler, colorGrade.getImageView(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL }
 			};
 
 			writeDescriptorSets[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
@@ -506,38 +490,22 @@ int main(int argc, char *argv[])
 		}
 
 
-		auto backBufferSemaphore = createSemaphore(),
-		     presentCompleteSemaphore = createSemaphore();
-
-		VkCommandPool commandPool = createCommandPool(graphicsQueueFamily);
-
-		auto commandBuffers = allocateCommandBuffers(commandPool, swapChain.getImageViews().size());
+		finishUploads();
+		setupCleanup();
 
-		auto commandBufferFences = new VkFence[commandBuffers.size()];
-		for (auto i = 0u; i < commandBuffers.size(); ++i)
-			commandBufferFences[i] = createFence(VK_FENCE_CREATE_SIGNALED_BIT);
+		// the draw list, indexable so it can be split between workers
+		vector<const Object *> objects;
+		auto objectsVersion = ~uint64_t(0);
 
-		setupCleanup();
+		StaticSegment sceneSegment(frameQueue.getFramesInFlight());
+		StaticSegment postProcessSegment(frameQueue.getFramesInFlight());
 
 		auto startTime = glfwGetTime();
 		while (!glfwWindowShouldClose(win)) {
 			auto time = glfwGetTime() - startTime;
 
-			auto currentSwapImage = swapChain.aquireNextImage(backBufferSemaphore);
-
-			err = vkWaitForFences(device, 1, &commandBufferFences[currentSwapImage], VK_TRUE, UINT64_MAX);
-			assert(err == VK_SUCCESS);
-
-			err = vkResetFences(device, 1, &commandBufferFences[currentSwapImage]);
-			assert(err == VK_SUCCESS);
-
-			auto commandBuffer = commandBuffers[currentSwapImage];
-			VkCommandBufferBeginInfo commandBufferBeginInfo = {};
-			commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-			commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-			err = vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo);
-			assert(err == VK_SUCCESS);
+			auto &frame = frameQueue.beginFrame();
+			auto commandBuffer = frame.commandBuffer;
 
 			VkClearValue clearValues[2];
 			clearValues[0].depthStencil = { 1.0f, 0 };
@@ -559,10 +527,7 @@ int main(int argc, char *argv[])
 			renderPassBeginInfo.pClearValues = clearValues;
 			renderPassBeginInfo.framebuffer = framebuffer;
 
-			vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-			setViewport(commandBuffer, 0, 0, float(width), float(height));
-			setScissor(commandBuffer, 0, 0, width, height);
+			vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 
 			auto th = float(time);
 
@@ -579,63 +544,90 @@ int main(int argc, char *argv[])
 			auto projectionMatrix = glm::perspective(fov * float(M_PI / 180.0f), aspect, znear, zfar);
 			auto viewProjectionMatrix = projectionMatrix * viewMatrix;
 
-			auto offset = 0u;
-			map<const Transform*, unsigned int> offsetMap;
-			auto transforms = scene.getTransforms();
-			auto ptr = uniformBuffer.map(0, uniformBufferSpacing * transforms.size());
-			for (auto transform : transforms) {
+			map<const Transform*, uint32_t> offsetMap;
+			for (auto transform : scene.getTransforms()) {
 				auto modelMatrix = transform->getAbsoluteMatrix();
 				auto modelViewProjectionMatrix = viewProjectionMatrix * modelMatrix;
 				perObjectUniforms.modelViewProjectionMatrix = modelViewProjectionMatrix;
-				memcpy(static_cast<uint8_t *>(ptr) + offset, &perObjectUniforms, sizeof(perObjectUniforms));
-				offsetMap[transform] = offset;
-				offset += uniformBufferSpacing;
-			}
-			uniformBuffer.unmap();
-
-			VkDeviceSize vertexBufferOffsets[1] = { 0 };
-			VkBuffer vertexBuffers[1] = { vertexBuffer.getBuffer() };
-			vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, vertexBufferOffsets);
-			vkCmdBindIndexBuffer(commandBuffer, indexBuffer.getBuffer(), 0, VK_INDEX_TYPE_UINT16);
-			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-
-			for (auto object : scene.getObjects()) {
-				assert(offsetMap.count(&object.getTransform()) > 0);
-
-				auto offset = offsetMap[&object.getTransform()];
-				assert(offset <= uniformBufferSize - uniformSize);
-				uint32_t dynamicOffsets[] = { (uint32_t)offset };
-				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 1, dynamicOffsets);
-				// vkCmdDraw(commandBuffer, ARRAY_SIZE(vertexPositions), 1, 0, 0);
-				vkCmdDrawIndexed(commandBuffer, ARRAY_SIZE(CubeData::vertexIndices), 1, 0, 0, 0);
+				offsetMap[transform] = uniformRing.push(perObjectUniforms);
 			}
 
-			vkCmdEndRenderPass(commandBuffer);
+			if (objectsVersion != scene.getStructureVersion()) {
+				objects.clear();
+				for (auto &object : scene.getObjects())
+					objects.push_back(&object);
+				objectsVersion = scene.getStructureVersion();
+			}
 
-			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, postProcessPipeline);
-			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, postProcessShaderProgram.getPipelineLayout(), 0, 1, &postProcessDescriptorSet, 0, nullptr);
+			// Recorded again only when objects or transforms are added, or what
+			// the commands bind changes; the matrices change through the
+			// uniforms, at the same offsets
+			auto sceneKey = getSegmentKey({
+				scene.getStructureVersion(),
+				uint64_t(renderPass), uint64_t(framebuffer), uint64_t(pipeline), uint64_t(descriptorSet),
+				uint64_t(vertexBuffer.getBuffer()), uint64_t(indexBuffer.getBuffer()),
+				uint64_t(width), uint64_t(height)
+			});
+			sceneSegment.execute(frame, sceneKey, renderPass, 0, framebuffer, int(objects.size()), 256, [&](VkCommandBuffer commandBuffer, int begin, int end) {
+				setViewport(commandBuffer, 0, 0, float(width), float(height));
+				setScissor(commandBuffer, 0, 0, width, height);
+
+				VkDeviceSize vertexBufferOffsets[1] = { 0 };
+				VkBuffer vertexBuffers[1] = { vertexBuffer.getBuffer() };
+				vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, vertexBufferOffsets);
+				vkCmdBindIndexBuffer(commandBuffer, indexBuffer.getBuffer(), 0, VK_INDEX_TYPE_UINT16);
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+				for (auto i = begin; i < end; ++i) {
+					auto offset = offsetMap.find(&objects[i]->getTransform());
+					assert(offset != offsetMap.end());
+
+					uint32_t dynamicOffsets[] = { offset->second };
+					vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shaderProgram.getPipelineLayout(), 0, 1, &descriptorSet, 1, dynamicOffsets);
+					// vkCmdDraw(commandBuffer, ARRAY_SIZE(vertexPositions), 1, 0, 0);
+					vkCmdDrawIndexed(commandBuffer, ARRAY_SIZE(CubeData::vertexIndices), 1, 0, 0, 0);
+				}
+			});
 
-			imageBarrier(
-				commandBuffer,
-				postProcessRenderTarget.getImage(),
-				VK_IMAGE_ASPECT_COLOR_BIT,
-				VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-				0, VK_ACCESS_SHADER_WRITE_BIT,
-				VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+			vkCmdEndRenderPass(commandBuffer);
 
-			vkCmdDispatch(commandBuffer, width / 16, height / 16, 1);
+			// only re-bakes when the grade changes
+			colorGrade.clear();
+			colorGrade.applyLut(colorLutIndex);
+			colorGrade.record(commandBuffer);
 
-			imageBarrier(
-				commandBuffer,
-				postProcessRenderTarget.getImage(),
-				VK_IMAGE_ASPECT_COLOR_BIT,
-				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
-				VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
-				VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+			// none of the post-processing pass changes between frames, unless its pipeline or target is replaced
+			auto postProcessKey = getSegmentKey({
+				uint64_t(postProcessPipeline), uint64_t(postProcessDescriptorSet),
+				uint64_t(postProcessRenderTarget.getImage()),
+				uint64_t(width), uint64_t(height)
+			});
+			postProcessSegment.execute(frame, postProcessKey, VK_NULL_HANDLE, 0, VK_NULL_HANDLE, 1, 1, [&](VkCommandBuffer commandBuffer, int, int) {
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, postProcessPipeline);
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, postProcessShaderProgram.getPipelineLayout(), 0, 1, &postProcessDescriptorSet, 0, nullptr);
+
+				imageBarrier(
+					commandBuffer,
+					postProcessRenderTarget.getImage(),
+					VK_IMAGE_ASPECT_COLOR_BIT,
+					VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+					0, VK_ACCESS_SHADER_WRITE_BIT,
+					VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+
+				vkCmdDispatch(commandBuffer, width / postProcessShaderProgram.getWorkgroupSize(0), height / postProcessShaderProgram.getWorkgroupSize(1), 1);
+
+				imageBarrier(
+					commandBuffer,
+					postProcessRenderTarget.getImage(),
+					VK_IMAGE_ASPECT_COLOR_BIT,
+					VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+					VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+					VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+			});
 
 			imageBarrier(
 				commandBuffer,
-				images[currentSwapImage],
+				images[frame.swapImage],
 				VK_IMAGE_ASPECT_COLOR_BIT,
 				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
 				0, VK_ACCESS_TRANSFER_WRITE_BIT,
@@ -643,39 +635,21 @@ int main(int argc, char *argv[])
 
 			blitImage(commandBuffer,
 				postProcessRenderTarget.getImage(),
-				images[currentSwapImage],
+				images[frame.swapImage],
 				width, height,
 				{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
 				{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 });
 
 			imageBarrier(
 				commandBuffer,
-				images[currentSwapImage],
+				images[frame.swapImage],
 				VK_IMAGE_ASPECT_COLOR_BIT,
 				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
 				VK_ACCESS_TRANSFER_WRITE_BIT, 0,
 				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
 
-			err = vkEndCommandBuffer(commandBuffer);
-			assert(err == VK_SUCCESS);
-
-			VkPipelineStageFlags waitDstStageMask = VK_PIPELINE_BIND_POINT_COMPUTE;
-
-			VkSubmitInfo submitInfo = {};
-			submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-			submitInfo.waitSemaphoreCount = 1;
-			submitInfo.pWaitSemaphores = &backBufferSemaphore;
-			submitInfo.signalSemaphoreCount = 1;
-			submitInfo.pSignalSemaphores = &presentCompleteSemaphore;
-			submitInfo.pWaitDstStageMask = &waitDstStageMask;
-			submitInfo.commandBufferCount = 1;
-			submitInfo.pCommandBuffers = &commandBuffer;
-
-			// Submit draw command buffer
-			err = vkQueueSubmit(graphicsQueue, 1, &submitInfo, commandBufferFences[currentSwapImage]);
-			assert(err == VK_SUCCESS);
-
-			swapChain.queuePresent(currentSwapImage, &presentCompleteSemaphore, 1);
+			// the swap chain image is first written by the blit
+			frameQueue.endFrame(VK_PIPELINE_STAGE_TRANSFER_BIT);
 
 			glfwPollEvents();
 		}
@@ -683,6 +657,10 @@ int main(int argc, char *argv[])
 		err = vkDeviceWaitIdle(device);
 		assert(err == VK_SUCCESS);
 
+		savePipelineCache();
+		vkDestroyPipelineCache(device, pipelineCache, nullptr);
+		pipelineCache = VK_NULL_HANDLE;
+
 	} catch (const exception &e) {
 		if (win != nullptr)
 			glfwDestroyWindow(win);
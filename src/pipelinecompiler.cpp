@@ -0,0 +1,180 @@
+#include "pipelinecompiler.h"
+
+#include <algorithm>
+
+using namespace vulkan;
+
+using std::vector;
+using std::unique_lock;
+using std::lock_guard;
+using std::mutex;
+using std::packaged_task;
+using std::shared_future;
+
+VkPipeline createGraphicsPipeline(const GraphicsPipelineDesc &desc)
+{
+	assert(desc.shaderProgram != nullptr);
+
+	VkPipelineVertexInputStateCreateInfo pipelineVertexInputStateCreateInfo = {};
+	pipelineVertexInputStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	pipelineVertexInputStateCreateInfo.vertexBindingDescriptionCount = uint32_t(desc.vertexBindings.size());
+	pipelineVertexInputStateCreateInfo.pVertexBindingDescriptions = desc.vertexBindings.data();
+	pipelineVertexInputStateCreateInfo.vertexAttributeDescriptionCount = uint32_t(desc.vertexAttributes.size());
+	pipelineVertexInputStateCreateInfo.pVertexAttributeDescriptions = desc.vertexAttributes.data();
+
+	VkPipelineInputAssemblyStateCreateInfo pipelineInputAssemblyStateCreateInfo = {};
+	pipelineInputAssemblyStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	pipelineInputAssemblyStateCreateInfo.topology = desc.topology;
+	pipelineInputAssemblyStateCreateInfo.primitiveRestartEnable = VK_FALSE;
+
+	VkPipelineRasterizationStateCreateInfo pipelineRasterizationStateCreateInfo = {};
+	pipelineRasterizationStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	pipelineRasterizationStateCreateInfo.polygonMode = VK_POLYGON_MODE_FILL;
+	pipelineRasterizationStateCreateInfo.cullMode = desc.cullMode;
+	pipelineRasterizationStateCreateInfo.frontFace = desc.frontFace;
+	pipelineRasterizationStateCreateInfo.lineWidth = 1.0f;
+
+	VkPipelineColorBlendAttachmentState pipelineColorBlendAttachmentState = {};
+	pipelineColorBlendAttachmentState.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+	pipelineColorBlendAttachmentState.blendEnable = VK_FALSE;
+	vector<VkPipelineColorBlendAttachmentState> pipelineColorBlendAttachmentStates(desc.colorAttachmentCount, pipelineColorBlendAttachmentState);
+
+	VkPipelineColorBlendStateCreateInfo pipelineColorBlendStateCreateInfo = {};
+	pipelineColorBlendStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	pipelineColorBlendStateCreateInfo.attachmentCount = uint32_t(pipelineColorBlendAttachmentStates.size());
+	pipelineColorBlendStateCreateInfo.pAttachments = pipelineColorBlendAttachmentStates.data();
+
+	VkPipelineMultisampleStateCreateInfo pipelineMultisampleStateCreateInfo = {};
+	pipelineMultisampleStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	pipelineMultisampleStateCreateInfo.rasterizationSamples = desc.rasterizationSamples;
+
+	VkPipelineViewportStateCreateInfo pipelineViewportStateCreateInfo = {};
+	pipelineViewportStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	pipelineViewportStateCreateInfo.viewportCount = 1;
+	pipelineViewportStateCreateInfo.pViewports = nullptr;
+	pipelineViewportStateCreateInfo.scissorCount = 1;
+	pipelineViewportStateCreateInfo.pScissors = nullptr;
+
+	VkPipelineDepthStencilStateCreateInfo pipelineDepthStencilStateCreateInfo = {};
+	pipelineDepthStencilStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	pipelineDepthStencilStateCreateInfo.depthTestEnable = desc.depthTestEnable ? VK_TRUE : VK_FALSE;
+	pipelineDepthStencilStateCreateInfo.depthWriteEnable = desc.depthWriteEnable ? VK_TRUE : VK_FALSE;
+	pipelineDepthStencilStateCreateInfo.depthCompareOp = desc.depthCompareOp;
+
+	VkDynamicState dynamicStateEnables[] = {
+		VK_DYNAMIC_STATE_VIEWPORT,
+		VK_DYNAMIC_STATE_SCISSOR
+	};
+
+	VkPipelineDynamicStateCreateInfo pipelineDynamicStateCreateInfo = {};
+	pipelineDynamicStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	pipelineDynamicStateCreateInfo.pDynamicStates = dynamicStateEnables;
+	pipelineDynamicStateCreateInfo.dynamicStateCount = ARRAY_SIZE(dynamicStateEnables);
+
+	VkGraphicsPipelineCreateInfo pipelineCreateInfo = {};
+	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipelineCreateInfo.layout = desc.shaderProgram->getPipelineLayout();
+	pipelineCreateInfo.renderPass = desc.renderPass;
+	pipelineCreateInfo.subpass = desc.subpass;
+	pipelineCreateInfo.pVertexInputState = &pipelineVertexInputStateCreateInfo;
+	pipelineCreateInfo.pInputAssemblyState = &pipelineInputAssemblyStateCreateInfo;
+	pipelineCreateInfo.pRasterizationState = &pipelineRasterizationStateCreateInfo;
+	pipelineCreateInfo.pColorBlendState = &pipelineColorBlendStateCreateInfo;
+	pipelineCreateInfo.pMultisampleState = &pipelineMultisampleStateCreateInfo;
+	pipelineCreateInfo.pViewportState = &pipelineViewportStateCreateInfo;
+	pipelineCreateInfo.pDepthStencilState = &pipelineDepthStencilStateCreateInfo;
+	pipelineCreateInfo.pDynamicState = &pipelineDynamicStateCreateInfo;
+
+	auto shaderStages = desc.shaderProgram->getPipelineShaderStageCreateInfos();
+	pipelineCreateInfo.stageCount = uint32_t(shaderStages.size());
+	pipelineCreateInfo.pStages = shaderStages.data();
+
+	VkPipeline pipeline;
+	auto err = vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipeline);
+	assert(err == VK_SUCCESS);
+
+	return pipeline;
+}
+
+PipelineCompiler::PipelineCompiler(int threadCount) :
+	busyCount(0),
+	quit(false)
+{
+	if (threadCount <= 0)
+		threadCount = std::max(int(std::thread::hardware_concurrency()), 1);
+
+	for (auto i = 0; i < threadCount; ++i)
+		threads.push_back(std::thread(&PipelineCompiler::compilePipelines, this));
+}
+
+PipelineCompiler::~PipelineCompiler()
+{
+	{
+		lock_guard<mutex> lock(queueMutex);
+		quit = true;
+	}
+	requestCondition.notify_all();
+	for (auto &thread : threads)
+		thread.join();
+}
+
+shared_future<VkPipeline> PipelineCompiler::compile(const GraphicsPipelineDesc &desc)
+{
+	return enqueue(packaged_task<VkPipeline()>([desc] {
+		return createGraphicsPipeline(desc);
+	}));
+}
+
+shared_future<VkPipeline> PipelineCompiler::compile(const ShaderProgram &computeProgram)
+{
+	auto shaderProgram = &computeProgram;
+	return enqueue(packaged_task<VkPipeline()>([shaderProgram] {
+		return createComputePipeline(*shaderProgram);
+	}));
+}
+
+void PipelineCompiler::waitIdle()
+{
+	unique_lock<mutex> lock(queueMutex);
+	idleCondition.wait(lock, [&] { return requests.empty() && busyCount == 0; });
+}
+
+shared_future<VkPipeline> PipelineCompiler::enqueue(packaged_task<VkPipeline()> task)
+{
+	auto future = task.get_future().share();
+	{
+		lock_guard<mutex> lock(queueMutex);
+		assert(!quit);
+		requests.push_back(std::move(task));
+	}
+	requestCondition.notify_one();
+	return future;
+}
+
+void PipelineCompiler::compilePipelines()
+{
+	for (;;) {
+		packaged_task<VkPipeline()> task;
+		{
+			unique_lock<mutex> lock(queueMutex);
+			requestCondition.wait(lock, [&] { return quit || !requests.empty(); });
+
+			// drain the queue before quitting, so no future is left without a value
+			if (requests.empty())
+				return;
+
+			task = std::move(requests.front());
+			requests.pop_front();
+			++busyCount;
+		}
+
+		// exceptions end up in the future
+		task();
+
+		{
+			lock_guard<mutex> lock(queueMutex);
+			--busyCount;
+		}
+		idleCondition.notify_all();
+	}
+}
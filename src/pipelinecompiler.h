@@ -0,0 +1,87 @@
+#ifndef PIPELINECOMPILER_H
+#define PIPELINECOMPILER_H
+
+#include "vkinstance.h"
+#include "shader.h"
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Everything needed to build a graphics pipeline, held by value so it can be compiled on another thread
+struct GraphicsPipelineDesc {
+	GraphicsPipelineDesc(const ShaderProgram &shaderProgram, VkRenderPass renderPass, uint32_t subpass = 0) :
+		shaderProgram(&shaderProgram),
+		renderPass(renderPass),
+		subpass(subpass),
+		topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST),
+		cullMode(VK_CULL_MODE_BACK_BIT),
+		frontFace(VK_FRONT_FACE_CLOCKWISE),
+		depthTestEnable(true),
+		depthWriteEnable(true),
+		depthCompareOp(VK_COMPARE_OP_LESS_OR_EQUAL),
+		rasterizationSamples(VK_SAMPLE_COUNT_1_BIT),
+		colorAttachmentCount(1)
+	{
+	}
+
+	const ShaderProgram *shaderProgram;
+	VkRenderPass renderPass;
+	uint32_t subpass;
+
+	std::vector<VkVertexInputBindingDescription> vertexBindings;
+	std::vector<VkVertexInputAttributeDescription> vertexAttributes;
+
+	VkPrimitiveTopology topology;
+	VkCullModeFlags cullMode;
+	VkFrontFace frontFace;
+	bool depthTestEnable, depthWriteEnable;
+	VkCompareOp depthCompareOp;
+	VkSampleCountFlagBits rasterizationSamples;
+	int colorAttachmentCount; // written without blending; viewport and scissor are dynamic
+};
+
+VkPipeline createGraphicsPipeline(const GraphicsPipelineDesc &desc);
+
+/*
+ * Compiles pipelines on a pool of worker threads, so pipelines that are
+ * needed later can be built while earlier ones are already in use, and so
+ * building many of them at startup scales with the number of cores. All
+ * workers share vulkan::pipelineCache, which Vulkan synchronizes itself.
+ *
+ * The ShaderProgram a pipeline is compiled from has to outlive its future.
+ */
+class PipelineCompiler {
+public:
+	// threadCount 0 means one per core
+	explicit PipelineCompiler(int threadCount = 0);
+
+	// finishes what is queued before returning
+	~PipelineCompiler();
+
+	PipelineCompiler(const PipelineCompiler &) = delete;
+	PipelineCompiler &operator=(const PipelineCompiler &) = delete;
+
+	std::shared_future<VkPipeline> compile(const GraphicsPipelineDesc &desc);
+	std::shared_future<VkPipeline> compile(const ShaderProgram &computeProgram);
+
+	// blocks until everything queued so far has been compiled
+	void waitIdle();
+
+private:
+	std::shared_future<VkPipeline> enqueue(std::packaged_task<VkPipeline()> task);
+	void compilePipelines();
+
+	std::mutex queueMutex;
+	std::condition_variable requestCondition, idleCondition;
+	std::deque<std::packaged_task<VkPipeline()>> requests;
+	int busyCount;
+	bool quit;
+
+	std::vector<std::thread> threads;
+};
+
+#endif // PIPELINECOMPILER_H
@@ -0,0 +1,523 @@
+#include "block-compress.h"
+#include "../core/parallel.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+using std::min;
+using std::max;
+using std::swap;
+
+// A 4x4 block of pixels with up to four channels, in the value range the
+// format interpolates in (0-255 for 8-bit formats, half-float bits for BC6H)
+typedef float BlockPixels[16][4];
+
+static void fetchBlockRGBA8(const uint8_t *src, int width, int height, int blockX, int blockY, BlockPixels pixels)
+{
+	for (auto i = 0; i < 16; ++i) {
+		auto x = min(blockX * 4 + i % 4, width - 1);
+		auto y = min(blockY * 4 + i / 4, height - 1);
+		auto pixel = src + (size_t(y) * width + x) * 4;
+		for (auto c = 0; c < 4; ++c)
+			pixels[i][c] = pixel[c];
+	}
+}
+
+// BC6H_UFLOAT can't store negatives, infinities or NaNs, so those are clamped
+static void fetchBlockBC6H(const uint16_t *src, int width, int height, int blockX, int blockY, BlockPixels pixels)
+{
+	for (auto i = 0; i < 16; ++i) {
+		auto x = min(blockX * 4 + i % 4, width - 1);
+		auto y = min(blockY * 4 + i / 4, height - 1);
+		auto pixel = src + (size_t(y) * width + x) * 4;
+		for (auto c = 0; c < 4; ++c) {
+			auto bits = pixel[c];
+			if (bits & 0x8000)
+				bits = 0;
+			else if (bits >= 0x7c00)
+				bits = bits == 0x7c00 ? 0x7bff : 0;
+			pixels[i][c] = bits;
+		}
+	}
+}
+
+// Endpoints spanning the block along its principal axis
+static void fitEndpoints(const BlockPixels pixels, int channels, float e0[4], float e1[4])
+{
+	float mean[4] = {};
+	for (auto i = 0; i < 16; ++i)
+		for (auto c = 0; c < channels; ++c)
+			mean[c] += pixels[i][c] / 16;
+
+	float covariance[4][4] = {};
+	for (auto i = 0; i < 16; ++i)
+		for (auto a = 0; a < channels; ++a)
+			for (auto b = 0; b < channels; ++b)
+				covariance[a][b] += (pixels[i][a] - mean[a]) * (pixels[i][b] - mean[b]);
+
+	// power iteration, starting from the row of the most varying channel
+	auto largest = 0;
+	for (auto c = 1; c < channels; ++c)
+		if (covariance[c][c] > covariance[largest][largest])
+			largest = c;
+
+	float axis[4];
+	memcpy(axis, covariance[largest], sizeof(axis));
+	for (auto iteration = 0; iteration < 8; ++iteration) {
+		float next[4] = {};
+		for (auto a = 0; a < channels; ++a)
+			for (auto b = 0; b < channels; ++b)
+				next[a] += covariance[a][b] * axis[b];
+
+		float scale = 0;
+		for (auto c = 0; c < channels; ++c)
+			scale = max(scale, fabsf(next[c]));
+		if (scale == 0)
+			break;
+
+		for (auto c = 0; c < channels; ++c)
+			axis[c] = next[c] / scale;
+	}
+
+	float length = 0;
+	for (auto c = 0; c < channels; ++c)
+		length += axis[c] * axis[c];
+	length = sqrtf(length);
+
+	float tMin = 0, tMax = 0;
+	if (length > 0) {
+		for (auto c = 0; c < channels; ++c)
+			axis[c] /= length;
+
+		tMin = FLT_MAX;
+		tMax = -FLT_MAX;
+		for (auto i = 0; i < 16; ++i) {
+			float t = 0;
+			for (auto c = 0; c < channels; ++c)
+				t += (pixels[i][c] - mean[c]) * axis[c];
+			tMin = min(tMin, t);
+			tMax = max(tMax, t);
+		}
+	}
+
+	for (auto c = 0; c < channels; ++c) {
+		e0[c] = mean[c] + axis[c] * tMin;
+		e1[c] = mean[c] + axis[c] * tMax;
+	}
+}
+
+// Least-squares endpoints, given how far each pixel lies from e0 (0) to e1 (1)
+static bool solveEndpoints(const BlockPixels pixels, const float weights[16], int channels, float e0[4], float e1[4])
+{
+	float a = 0, b = 0, c = 0;
+	float x[4] = {}, y[4] = {};
+	for (auto i = 0; i < 16; ++i) {
+		auto w = weights[i], iw = 1 - w;
+		a += iw * iw;
+		b += iw * w;
+		c += w * w;
+		for (auto ch = 0; ch < channels; ++ch) {
+			x[ch] += iw * pixels[i][ch];
+			y[ch] += w * pixels[i][ch];
+		}
+	}
+
+	auto det = a * c - b * b;
+	if (fabsf(det) < 1e-6f)
+		return false;
+
+	for (auto ch = 0; ch < channels; ++ch) {
+		e0[ch] = (c * x[ch] - b * y[ch]) / det;
+		e1[ch] = (a * y[ch] - b * x[ch]) / det;
+	}
+	return true;
+}
+
+/*
+ * Encoders quantize the given endpoints, pick an index per pixel, and write
+ * the block. They return the squared error, and the position of each pixel
+ * between e0 and e1, for the least-squares refinement.
+ */
+typedef float (*EncodeFunc)(const BlockPixels pixels, const float e0[4], const float e1[4], uint8_t *out, float weights[16]);
+
+static void encodeBlock(const BlockPixels pixels, int channels, bool highQuality, EncodeFunc encode, uint8_t *out, size_t blockSize)
+{
+	float e0[4], e1[4], weights[16];
+	fitEndpoints(pixels, channels, e0, e1);
+	auto error = encode(pixels, e0, e1, out, weights);
+
+	if (!highQuality)
+		return;
+
+	for (auto iteration = 0; iteration < 3 && error > 0; ++iteration) {
+		if (!solveEndpoints(pixels, weights, channels, e0, e1))
+			break;
+
+		uint8_t candidate[16];
+		float candidateWeights[16];
+		auto candidateError = encode(pixels, e0, e1, candidate, candidateWeights);
+		if (candidateError >= error)
+			break;
+
+		memcpy(out, candidate, blockSize);
+		memcpy(weights, candidateWeights, sizeof(weights));
+		error = candidateError;
+	}
+}
+
+static int quantize(float value, int maxValue)
+{
+	return min(max(int(floorf(value + 0.5f)), 0), maxValue);
+}
+
+class BlockWriter {
+public:
+	BlockWriter(uint8_t *out, size_t size) : out(out), bit(0)
+	{
+		memset(out, 0, size);
+	}
+
+	void write(uint32_t value, int bits)
+	{
+		for (auto i = 0; i < bits; ++i, ++bit)
+			if ((value >> i) & 1)
+				out[bit / 8] |= 1 << (bit % 8);
+	}
+
+private:
+	uint8_t *out;
+	int bit;
+};
+
+static uint16_t packRGB565(const float color[4])
+{
+	auto r = quantize(color[0] * 31 / 255, 31);
+	auto g = quantize(color[1] * 63 / 255, 63);
+	auto b = quantize(color[2] * 31 / 255, 31);
+	return uint16_t((r << 11) | (g << 5) | b);
+}
+
+static void unpackRGB565(uint16_t packed, float color[4])
+{
+	auto r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+	color[0] = float((r << 3) | (r >> 2));
+	color[1] = float((g << 2) | (g >> 4));
+	color[2] = float((b << 3) | (b >> 2));
+}
+
+// The color part of BC1 and BC3, always in four-color mode
+static float encodeBC1Colors(const BlockPixels pixels, const float e0[4], const float e1[4], uint8_t *out, float weights[16])
+{
+	auto c0 = packRGB565(e0), c1 = packRGB565(e1);
+	auto swapped = c0 < c1;
+	if (swapped)
+		swap(c0, c1);
+
+	float palette[4][4];
+	unpackRGB565(c0, palette[0]);
+	unpackRGB565(c1, palette[1]);
+	for (auto c = 0; c < 3; ++c) {
+		palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+		palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+	}
+	static const float paletteWeights[4] = { 0, 1, 1 / 3.0f, 2 / 3.0f };
+
+	// c0 == c1 selects three-color mode, where only index 0 is safe
+	auto paletteSize = c0 == c1 ? 1 : 4;
+
+	uint32_t indices = 0;
+	float error = 0;
+	for (auto i = 0; i < 16; ++i) {
+		auto best = 0;
+		auto bestError = FLT_MAX;
+		for (auto j = 0; j < paletteSize; ++j) {
+			float e = 0;
+			for (auto c = 0; c < 3; ++c)
+				e += (pixels[i][c] - palette[j][c]) * (pixels[i][c] - palette[j][c]);
+			if (e < bestError) {
+				best = j;
+				bestError = e;
+			}
+		}
+		indices |= uint32_t(best) << (2 * i);
+		weights[i] = swapped ? 1 - paletteWeights[best] : paletteWeights[best];
+		error += bestError;
+	}
+
+	BlockWriter writer(out, 8);
+	writer.write(c0, 16);
+	writer.write(c1, 16);
+	writer.write(indices, 32);
+	return error;
+}
+
+// BC4 in eight-value mode; only one channel of the block is used
+static float encodeBC4(const BlockPixels pixels, const float e0[4], const float e1[4], uint8_t *out, float weights[16])
+{
+	auto a0 = quantize(e0[0], 255), a1 = quantize(e1[0], 255);
+	auto swapped = a0 < a1;
+	if (swapped)
+		swap(a0, a1);
+
+	// a0 > a1 interpolates six values, a0 <= a1 four plus 0 and 255
+	float palette[8], paletteWeights[8] = { 0, 1 };
+	palette[0] = float(a0);
+	palette[1] = float(a1);
+	if (a0 > a1) {
+		for (auto i = 2; i < 8; ++i) {
+			palette[i] = ((8 - i) * a0 + (i - 1) * a1) / 7.0f;
+			paletteWeights[i] = (i - 1) / 7.0f;
+		}
+	} else {
+		for (auto i = 2; i < 6; ++i) {
+			palette[i] = ((6 - i) * a0 + (i - 1) * a1) / 5.0f;
+			paletteWeights[i] = (i - 1) / 5.0f;
+		}
+		palette[6] = 0;
+		palette[7] = 255;
+		paletteWeights[6] = paletteWeights[7] = 0;
+	}
+
+	uint64_t indices = 0;
+	float error = 0;
+	for (auto i = 0; i < 16; ++i) {
+		auto best = 0;
+		auto bestError = FLT_MAX;
+		for (auto j = 0; j < 8; ++j) {
+			auto e = (pixels[i][0] - palette[j]) * (pixels[i][0] - palette[j]);
+			if (e < bestError) {
+				best = j;
+				bestError = e;
+			}
+		}
+		indices |= uint64_t(best) << (3 * i);
+		weights[i] = swapped ? 1 - paletteWeights[best] : paletteWeights[best];
+		error += bestError;
+	}
+
+	BlockWriter writer(out, 8);
+	writer.write(a0, 8);
+	writer.write(a1, 8);
+	writer.write(uint32_t(indices), 24);
+	writer.write(uint32_t(indices >> 24), 24);
+	return error;
+}
+
+static void encodeBC4Channel(const BlockPixels pixels, int channel, bool highQuality, uint8_t *out)
+{
+	BlockPixels values;
+	for (auto i = 0; i < 16; ++i)
+		values[i][0] = pixels[i][channel];
+
+	encodeBlock(values, 1, highQuality, encodeBC4, out, 8);
+}
+
+static const int bc7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// 7 bits per channel plus a shared low bit (the "p-bit") per endpoint
+static void quantizeBC7Endpoint(const float endpoint[4], int quantized[4], int *pbit)
+{
+	auto bestError = FLT_MAX;
+	for (auto p = 0; p < 2; ++p) {
+		int q[4];
+		float error = 0;
+		for (auto c = 0; c < 4; ++c) {
+			q[c] = quantize((endpoint[c] - p) / 2, 127);
+			auto e = (q[c] * 2 + p) - endpoint[c];
+			error += e * e;
+		}
+		if (error < bestError) {
+			bestError = error;
+			memcpy(quantized, q, sizeof(q));
+			*pbit = p;
+		}
+	}
+}
+
+// BC7 mode 6: one subset, RGBA endpoints, 4-bit indices
+static float encodeBC7Mode6(const BlockPixels pixels, const float e0[4], const float e1[4], uint8_t *out, float weights[16])
+{
+	int q0[4], q1[4], p0, p1;
+	quantizeBC7Endpoint(e0, q0, &p0);
+	quantizeBC7Endpoint(e1, q1, &p1);
+
+	float palette[16][4];
+	for (auto j = 0; j < 16; ++j)
+		for (auto c = 0; c < 4; ++c) {
+			auto end0 = q0[c] * 2 + p0, end1 = q1[c] * 2 + p1;
+			palette[j][c] = float(((64 - bc7Weights4[j]) * end0 + bc7Weights4[j] * end1 + 32) >> 6);
+		}
+
+	int indices[16];
+	float error = 0;
+	for (auto i = 0; i < 16; ++i) {
+		auto bestError = FLT_MAX;
+		for (auto j = 0; j < 16; ++j) {
+			float e = 0;
+			for (auto c = 0; c < 4; ++c)
+				e += (pixels[i][c] - palette[j][c]) * (pixels[i][c] - palette[j][c]);
+			if (e < bestError) {
+				indices[i] = j;
+				bestError = e;
+			}
+		}
+		weights[i] = bc7Weights4[indices[i]] / 64.0f;
+		error += bestError;
+	}
+
+	// the first index has an implicit zero top bit
+	if (indices[0] & 8) {
+		for (auto c = 0; c < 4; ++c)
+			swap(q0[c], q1[c]);
+		swap(p0, p1);
+		for (auto i = 0; i < 16; ++i)
+			indices[i] = 15 - indices[i];
+	}
+
+	BlockWriter writer(out, 16);
+	writer.write(1 << 6, 7);
+	for (auto c = 0; c < 4; ++c) {
+		writer.write(q0[c], 7);
+		writer.write(q1[c], 7);
+	}
+	writer.write(p0, 1);
+	writer.write(p1, 1);
+	writer.write(indices[0], 3);
+	for (auto i = 1; i < 16; ++i)
+		writer.write(indices[i], 4);
+	return error;
+}
+
+// The decoder scales unquantized endpoints by 31/64 to get half-float bits
+static int quantizeBC6H(float halfBits)
+{
+	return quantize((halfBits * 64 / 31 - 32) / 64, 1023);
+}
+
+static int unquantizeBC6H(int quantized)
+{
+	if (quantized == 0)
+		return 0;
+	if (quantized == 1023)
+		return 0xffff;
+	return (quantized << 6) + 32;
+}
+
+// BC6H mode 11: one region, 10-bit RGB endpoints without deltas, 4-bit indices
+static float encodeBC6HMode11(const BlockPixels pixels, const float e0[4], const float e1[4], uint8_t *out, float weights[16])
+{
+	int q0[3], q1[3];
+	for (auto c = 0; c < 3; ++c) {
+		q0[c] = quantizeBC6H(e0[c]);
+		q1[c] = quantizeBC6H(e1[c]);
+	}
+
+	float palette[16][3];
+	for (auto j = 0; j < 16; ++j)
+		for (auto c = 0; c < 3; ++c) {
+			auto u0 = unquantizeBC6H(q0[c]), u1 = unquantizeBC6H(q1[c]);
+			auto interpolated = ((64 - bc7Weights4[j]) * u0 + bc7Weights4[j] * u1 + 32) >> 6;
+			palette[j][c] = float((interpolated * 31) >> 6);
+		}
+
+	int indices[16];
+	float error = 0;
+	for (auto i = 0; i < 16; ++i) {
+		auto bestError = FLT_MAX;
+		for (auto j = 0; j < 16; ++j) {
+			float e = 0;
+			for (auto c = 0; c < 3; ++c)
+				e += (pixels[i][c] - palette[j][c]) * (pixels[i][c] - palette[j][c]);
+			if (e < bestError) {
+				indices[i] = j;
+				bestError = e;
+			}
+		}
+		weights[i] = bc7Weights4[indices[i]] / 64.0f;
+		error += bestError;
+	}
+
+	if (indices[0] & 8) {
+		for (auto c = 0; c < 3; ++c)
+			swap(q0[c], q1[c]);
+		for (auto i = 0; i < 16; ++i)
+			indices[i] = 15 - indices[i];
+	}
+
+	BlockWriter writer(out, 16);
+	writer.write(0x03, 5);
+	for (auto c = 0; c < 3; ++c)
+		writer.write(q0[c], 10);
+	for (auto c = 0; c < 3; ++c)
+		writer.write(q1[c], 10);
+	writer.write(indices[0], 3);
+	for (auto i = 1; i < 16; ++i)
+		writer.write(indices[i], 4);
+	return error;
+}
+
+void blockCompress(VkFormat format, const void *src, int width, int height, void *dst, bool highQuality)
+{
+	switch (format) {
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		break;
+
+	default:
+		throw std::runtime_error("unsupported block-compressed format");
+	}
+
+	auto blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+	auto blockSize = size_t(vulkan::getFormatSize(format));
+	auto dstBytes = static_cast<uint8_t *>(dst);
+
+	parallelFor(blocksHigh, max(64 / blocksWide, 1), [&](int begin, int end) {
+		BlockPixels pixels;
+		for (auto blockY = begin; blockY < end; ++blockY) {
+			for (auto blockX = 0; blockX < blocksWide; ++blockX) {
+				auto out = dstBytes + (size_t(blockY) * blocksWide + blockX) * blockSize;
+
+				if (format == VK_FORMAT_BC6H_UFLOAT_BLOCK) {
+					fetchBlockBC6H(static_cast<const uint16_t *>(src), width, height, blockX, blockY, pixels);
+					encodeBlock(pixels, 3, highQuality, encodeBC6HMode11, out, blockSize);
+					continue;
+				}
+
+				fetchBlockRGBA8(static_cast<const uint8_t *>(src), width, height, blockX, blockY, pixels);
+				switch (format) {
+				case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+				case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+					encodeBlock(pixels, 3, highQuality, encodeBC1Colors, out, blockSize);
+					break;
+
+				case VK_FORMAT_BC3_UNORM_BLOCK:
+				case VK_FORMAT_BC3_SRGB_BLOCK:
+					encodeBC4Channel(pixels, 3, highQuality, out);
+					encodeBlock(pixels, 3, highQuality, encodeBC1Colors, out + 8, 8);
+					break;
+
+				case VK_FORMAT_BC4_UNORM_BLOCK:
+					encodeBC4Channel(pixels, 0, highQuality, out);
+					break;
+
+				case VK_FORMAT_BC5_UNORM_BLOCK:
+					encodeBC4Channel(pixels, 0, highQuality, out);
+					encodeBC4Channel(pixels, 1, highQuality, out + 8);
+					break;
+
+				default:
+					encodeBlock(pixels, 4, highQuality, encodeBC7Mode6, out, blockSize);
+				}
+			}
+		}
+	});
+}
@@ -0,0 +1,17 @@
+#ifndef BLOCK_COMPRESS_H
+#define BLOCK_COMPRESS_H
+
+#include "../vkinstance.h"
+
+/*
+ * Encode one width x height image into BCn blocks, spread over all cores.
+ * src is tightly packed R16G16B16A16_SFLOAT for BC6H_UFLOAT, and R8G8B8A8
+ * for BC1_RGB, BC3, BC4 (red), BC5 (red/green) and BC7. dst receives the
+ * blocks in row-major order; partial blocks at the edges repeat edge pixels.
+ *
+ * highQuality refines the endpoints with least-squares passes, which is
+ * several times slower.
+ */
+void blockCompress(VkFormat format, const void *src, int width, int height, void *dst, bool highQuality);
+
+#endif // BLOCK_COMPRESS_H
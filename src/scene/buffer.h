@@ -2,27 +2,33 @@
 #define BUFFER_H
 
 #include "../vkinstance.h"
+#include "device-memory.h"
 
 #include <cstring>
 
-class StagingBuffer;
-
 class Buffer {
 public:
-	Buffer(VkDeviceSize size, VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags);
+	// sharedWithTransferQueue lets both the graphics and transfer queues use it, without ownership transfers
+	Buffer(VkDeviceSize size, VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags, bool sharedWithTransferQueue = false);
 	~Buffer();
 
+	// host-visible memory stays mapped, so this only points into it
 	void *map(VkDeviceSize offset, VkDeviceSize size)
 	{
-		void *ret;
-		VkResult err = vkMapMemory(vulkan::device, deviceMemory, offset, size, 0, &ret);
-		assert(err == VK_SUCCESS);
-		return ret;
+		assert(memory.mappedData != nullptr);
+		assert(offset + size <= memory.size);
+		return memory.mappedData + offset;
 	}
 
+	// flushes the writes, unless the memory is coherent
 	void unmap()
 	{
-		vkUnmapMemory(vulkan::device, deviceMemory);
+		flushMemory(memory);
+	}
+
+	void flush(VkDeviceSize offset, VkDeviceSize size)
+	{
+		flushMemory(memory, offset, size);
 	}
 
 	void uploadMemory(VkDeviceSize offset, const void *data, VkDeviceSize size)
@@ -44,12 +50,10 @@ public:
 		return descriptorBufferInfo;
 	}
 
-	void uploadFromStagingBuffer(const StagingBuffer &stagingBuffer, VkDeviceSize srcOffset, VkDeviceSize dstOffset, VkDeviceSize size);
-
 private:
 	VkBuffer buffer;
 	VkDeviceSize size;
-	VkDeviceMemory deviceMemory;
+	DeviceMemoryAllocation memory;
 };
 
 class UniformBuffer : public Buffer {
@@ -61,7 +65,8 @@ public:
 
 class StagingBuffer : public Buffer {
 public:
-	StagingBuffer(VkDeviceSize size) : Buffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+	// coherent, so persistently mapped staging memory needs no flushing
+	StagingBuffer(VkDeviceSize size) : Buffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, true)
 	{
 	}
 };
@@ -0,0 +1,214 @@
+#include "color-grade.h"
+
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+
+using namespace vulkan;
+
+using std::vector;
+
+// the bake writes R16G16B16A16_SFLOAT, which all devices support as storage images
+#define COLOR_GRADE_FORMAT VK_FORMAT_R16G16B16A16_SFLOAT
+
+ColorGrade::ColorGrade(VkShaderModule shaderModule, int size) :
+	size(size),
+	bakedLut(COLOR_GRADE_FORMAT, size, size, size, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT),
+	uniformBuffer(sizeof(Uniforms), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+	shaderProgram({
+		ShaderStage(VK_SHADER_STAGE_COMPUTE_BIT, shaderModule)
+	}),
+	descriptorSet(VK_NULL_HANDLE),
+	hasBaked(false)
+{
+	assert(size >= 2);
+
+	pipeline = createComputePipeline(shaderProgram);
+	descriptorPool = createDescriptorPool({
+		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1 },
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, MAX_LUTS },
+	}, 1);
+	sampler = createSampler(0.0f, false, false);
+
+	memset(&pending, 0, sizeof(pending));
+	memset(&baked, 0, sizeof(baked));
+}
+
+ColorGrade::~ColorGrade()
+{
+	vkDestroySampler(device, sampler, nullptr);
+	vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+	vkDestroyPipeline(device, pipeline, nullptr);
+}
+
+int ColorGrade::addLut(Texture3D *lut)
+{
+	assert(descriptorSet == VK_NULL_HANDLE);
+	if (luts.size() == MAX_LUTS)
+		throw std::runtime_error("too many LUTs!");
+
+	luts.push_back(lut);
+	return int(luts.size()) - 1;
+}
+
+void ColorGrade::clear()
+{
+	memset(&pending, 0, sizeof(pending));
+}
+
+ColorGrade::Operation &ColorGrade::pushOperation(OperationType type)
+{
+	if (pending.operationCount == MAX_OPERATIONS)
+		throw std::runtime_error("too many grading operations!");
+
+	auto &operation = pending.operations[pending.operationCount++];
+	operation.type = type;
+	return operation;
+}
+
+void ColorGrade::applyLut(int lut, float amount)
+{
+	assert(lut >= 0 && lut < int(luts.size()));
+
+	auto &operation = pushOperation(OPERATION_LUT);
+	operation.lut0 = lut;
+	operation.params[0] = amount;
+}
+
+void ColorGrade::blendLuts(int from, int to, float t)
+{
+	assert(from >= 0 && from < int(luts.size()));
+	assert(to >= 0 && to < int(luts.size()));
+
+	auto &operation = pushOperation(OPERATION_BLEND);
+	operation.lut0 = from;
+	operation.lut1 = to;
+	operation.params[0] = t;
+}
+
+void ColorGrade::applyExposure(float stops)
+{
+	auto &operation = pushOperation(OPERATION_EXPOSURE);
+	operation.params[0] = stops;
+}
+
+void ColorGrade::applyCurve(const vector<glm::vec2> &points, glm::vec3 channels)
+{
+	assert(!points.empty());
+	if (points.size() > MAX_CURVE_POINTS)
+		throw std::runtime_error("too many curve points!");
+
+	auto &operation = pushOperation(OPERATION_CURVE);
+	operation.pointCount = int32_t(points.size());
+	operation.params[1] = channels.x;
+	operation.params[2] = channels.y;
+	operation.params[3] = channels.z;
+	for (auto i = 0u; i < points.size(); ++i) {
+		assert(i == 0 || points[i - 1].x <= points[i].x);
+		operation.points[i * 2 + 0] = points[i].x;
+		operation.points[i * 2 + 1] = points[i].y;
+	}
+}
+
+size_t ColorGrade::getUniformsSize(const Uniforms &uniforms) const
+{
+	return offsetof(Uniforms, operations) + sizeof(Operation) * uniforms.operationCount;
+}
+
+void ColorGrade::writeDescriptorSet()
+{
+	descriptorSet = allocateDescriptorSet(descriptorPool, shaderProgram.getDescriptorSetLayout());
+
+	VkDescriptorImageInfo lutImageInfo = { VK_NULL_HANDLE, bakedLut.getImageView(), VK_IMAGE_LAYOUT_GENERAL };
+	auto uniformBufferInfo = uniformBuffer.getDescriptorBufferInfo();
+
+	// Every array element needs a valid image, so pad with the output. That
+	// is in GENERAL while baking, and never read, as operations only refer
+	// to added LUTs.
+	vector<VkDescriptorImageInfo> lutInfos;
+	for (auto texture : luts)
+		lutInfos.push_back({ sampler, texture->getImageView(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL });
+	while (lutInfos.size() < MAX_LUTS)
+		lutInfos.push_back({ sampler, bakedLut.getImageView(), VK_IMAGE_LAYOUT_GENERAL });
+
+	VkWriteDescriptorSet writeDescriptorSets[3] = {};
+	writeDescriptorSets[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writeDescriptorSets[0].dstSet = descriptorSet;
+	writeDescriptorSets[0].dstBinding = 0;
+	writeDescriptorSets[0].descriptorCount = 1;
+	writeDescriptorSets[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	writeDescriptorSets[0].pImageInfo = &lutImageInfo;
+
+	writeDescriptorSets[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writeDescriptorSets[1].dstSet = descriptorSet;
+	writeDescriptorSets[1].dstBinding = 1;
+	writeDescriptorSets[1].descriptorCount = 1;
+	writeDescriptorSets[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	writeDescriptorSets[1].pBufferInfo = &uniformBufferInfo;
+
+	writeDescriptorSets[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writeDescriptorSets[2].dstSet = descriptorSet;
+	writeDescriptorSets[2].dstBinding = 2;
+	writeDescriptorSets[2].descriptorCount = uint32_t(lutInfos.size());
+	writeDescriptorSets[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	writeDescriptorSets[2].pImageInfo = lutInfos.data();
+
+	vkUpdateDescriptorSets(device, ARRAY_SIZE(writeDescriptorSets), writeDescriptorSets, 0, nullptr);
+}
+
+void ColorGrade::record(VkCommandBuffer commandBuffer)
+{
+	auto uniformsSize = getUniformsSize(pending);
+	if (hasBaked && pending.operationCount == baked.operationCount &&
+	    memcmp(&pending, &baked, uniformsSize) == 0)
+		return;
+
+	if (descriptorSet == VK_NULL_HANDLE)
+		writeDescriptorSet();
+
+	// Earlier frames may still be sampling the previous bake, and reading
+	// the uniforms it was baked with
+	imageBarrier(
+		commandBuffer,
+		bakedLut.getImage(),
+		VK_IMAGE_ASPECT_COLOR_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, VK_ACCESS_SHADER_WRITE_BIT,
+		hasBaked ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED,
+		VK_IMAGE_LAYOUT_GENERAL);
+
+	// The uniforms travel in the command buffer, so bakes in flight keep theirs
+	vkCmdUpdateBuffer(commandBuffer, uniformBuffer.getBuffer(), 0, alignSize(uniformsSize, 4), &pending);
+
+	VkMemoryBarrier memoryBarrier = {};
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_UNIFORM_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+		1, &memoryBarrier,
+		0, nullptr,
+		0, nullptr);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, shaderProgram.getPipelineLayout(), 0, 1, &descriptorSet, 0, nullptr);
+
+	auto groupsX = (uint32_t(size) + shaderProgram.getWorkgroupSize(0) - 1) / shaderProgram.getWorkgroupSize(0);
+	auto groupsY = (uint32_t(size) + shaderProgram.getWorkgroupSize(1) - 1) / shaderProgram.getWorkgroupSize(1);
+	auto groupsZ = (uint32_t(size) + shaderProgram.getWorkgroupSize(2) - 1) / shaderProgram.getWorkgroupSize(2);
+	vkCmdDispatch(commandBuffer, groupsX, groupsY, groupsZ);
+
+	imageBarrier(
+		commandBuffer,
+		bakedLut.getImage(),
+		VK_IMAGE_ASPECT_COLOR_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+		VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+	memcpy(&baked, &pending, sizeof(baked));
+	hasBaked = true;
+}
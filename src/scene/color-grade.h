@@ -0,0 +1,99 @@
+#ifndef COLOR_GRADE_H
+#define COLOR_GRADE_H
+
+#include "texture.h"
+#include "rendertarget.h"
+#include "../shader.h"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+/*
+ * Bakes an ordered stack of grading operations into one 3D LUT with a
+ * compute pass, so post-processing does a single LUT fetch however complex
+ * the grade is. Rebuild the stack every frame; record() only dispatches
+ * when it differs from the stack baked last.
+ *
+ * Like .CUBE files, the baked LUT has its texels on the grid points, so
+ * sample it at color * (size - 1) / size + 0.5 / size.
+ */
+class ColorGrade {
+public:
+	enum {
+		MAX_LUTS = 8,
+		MAX_OPERATIONS = 16,
+		MAX_CURVE_POINTS = 8
+	};
+
+	// shaderModule is lut-bake.comp
+	explicit ColorGrade(VkShaderModule shaderModule, int size = 32);
+	~ColorGrade();
+
+	ColorGrade(const ColorGrade &) = delete;
+	ColorGrade &operator=(const ColorGrade &) = delete;
+
+	// Add all LUTs before the first record(). Returns the index the
+	// operations below refer to the LUT by.
+	int addLut(Texture3D *lut);
+
+	void clear();
+
+	// color = mix(color, lut(color), amount)
+	void applyLut(int lut, float amount = 1.0f);
+
+	// color = mix(from(color), to(color), t), for fading between looks
+	void blendLuts(int from, int to, float t);
+
+	void applyExposure(float stops);
+
+	// Piecewise-linear curve through points sorted on x, flat beyond the
+	// end points. channels scales how much it applies to red, green and blue.
+	void applyCurve(const std::vector<glm::vec2> &points, glm::vec3 channels = glm::vec3(1.0f));
+
+	// Leaves the baked LUT in SHADER_READ_ONLY_OPTIMAL, for compute and fragment shaders
+	void record(VkCommandBuffer commandBuffer);
+
+	VkImageView getImageView() { return bakedLut.getImageView(); }
+	int getSize() const { return size; }
+
+private:
+	enum OperationType {
+		OPERATION_LUT,
+		OPERATION_BLEND,
+		OPERATION_EXPOSURE,
+		OPERATION_CURVE
+	};
+
+	// matches the std140 layout in lut-bake.comp
+	struct Operation {
+		int32_t type, lut0, lut1, pointCount;
+		float params[4];
+		float points[MAX_CURVE_POINTS * 2];
+	};
+
+	struct Uniforms {
+		int32_t operationCount, padding[3];
+		Operation operations[MAX_OPERATIONS];
+	};
+
+	Operation &pushOperation(OperationType type);
+	size_t getUniformsSize(const Uniforms &uniforms) const;
+	void writeDescriptorSet();
+
+	int size;
+	VolumeRenderTarget bakedLut;
+	Buffer uniformBuffer;
+	std::vector<Texture3D *> luts;
+
+	ShaderProgram shaderProgram;
+	VkPipeline pipeline;
+	VkDescriptorPool descriptorPool;
+	VkDescriptorSet descriptorSet;
+	VkSampler sampler;
+
+	// the stack being built, and the one in the LUT
+	Uniforms pending, baked;
+	bool hasBaked;
+};
+
+#endif // COLOR_GRADE_H
@@ -0,0 +1,291 @@
+#include "convert-pixels.h"
+#include "../core/cpu.h"
+#include "../core/half.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <immintrin.h>
+#include <FreeImage.h>
+
+typedef void (*ConvertRowRGBA8Func)(const uint8_t *src, uint8_t *dst, int width);
+
+static void convertRowRGBA8_Scalar(const uint8_t *src, uint8_t *dst, int width)
+{
+	for (auto x = 0; x < width; ++x) {
+		dst[x * 4 + 0] = src[x * 4 + FI_RGBA_RED];
+		dst[x * 4 + 1] = src[x * 4 + FI_RGBA_GREEN];
+		dst[x * 4 + 2] = src[x * 4 + FI_RGBA_BLUE];
+		dst[x * 4 + 3] = src[x * 4 + FI_RGBA_ALPHA];
+	}
+}
+
+static void convertRowRGBA8_Copy(const uint8_t *src, uint8_t *dst, int width)
+{
+	memcpy(dst, src, size_t(width) * 4);
+}
+
+#define RGBA8_SHUFFLE(i) \
+	char(i + FI_RGBA_RED), char(i + FI_RGBA_GREEN), char(i + FI_RGBA_BLUE), char(i + FI_RGBA_ALPHA)
+
+TARGET_SSSE3 static void convertRowRGBA8_SSSE3(const uint8_t *src, uint8_t *dst, int width)
+{
+	auto shuffle = _mm_setr_epi8(RGBA8_SHUFFLE(0), RGBA8_SHUFFLE(4), RGBA8_SHUFFLE(8), RGBA8_SHUFFLE(12));
+
+	auto x = 0;
+	for (; x + 8 <= width; x += 8) {
+		auto s = reinterpret_cast<const __m128i *>(src + x * 4);
+		auto d = reinterpret_cast<__m128i *>(dst + x * 4);
+		_mm_storeu_si128(d, _mm_shuffle_epi8(_mm_loadu_si128(s), shuffle));
+		_mm_storeu_si128(d + 1, _mm_shuffle_epi8(_mm_loadu_si128(s + 1), shuffle));
+	}
+
+	convertRowRGBA8_Scalar(src + x * 4, dst + x * 4, width - x);
+}
+
+TARGET_AVX2 static void convertRowRGBA8_AVX2(const uint8_t *src, uint8_t *dst, int width)
+{
+	// vpshufb works within 128-bit lanes, so the pattern repeats per lane
+	auto shuffle = _mm256_setr_epi8(
+		RGBA8_SHUFFLE(0), RGBA8_SHUFFLE(4), RGBA8_SHUFFLE(8), RGBA8_SHUFFLE(12),
+		RGBA8_SHUFFLE(0), RGBA8_SHUFFLE(4), RGBA8_SHUFFLE(8), RGBA8_SHUFFLE(12));
+
+	auto x = 0;
+	for (; x + 16 <= width; x += 16) {
+		auto s = reinterpret_cast<const __m256i *>(src + x * 4);
+		auto d = reinterpret_cast<__m256i *>(dst + x * 4);
+		_mm256_storeu_si256(d, _mm256_shuffle_epi8(_mm256_loadu_si256(s), shuffle));
+		_mm256_storeu_si256(d + 1, _mm256_shuffle_epi8(_mm256_loadu_si256(s + 1), shuffle));
+	}
+
+	convertRowRGBA8_Scalar(src + x * 4, dst + x * 4, width - x);
+}
+
+#undef RGBA8_SHUFFLE
+
+static void convertRowRGB8_Scalar(const uint8_t *src, uint8_t *dst, int width)
+{
+	for (auto x = 0; x < width; ++x) {
+		dst[x * 4 + 0] = src[x * 3 + FI_RGBA_RED];
+		dst[x * 4 + 1] = src[x * 3 + FI_RGBA_GREEN];
+		dst[x * 4 + 2] = src[x * 3 + FI_RGBA_BLUE];
+		dst[x * 4 + 3] = 0xff;
+	}
+}
+
+// alpha bytes are zeroed by the shuffle, and or'ed in afterwards
+#define RGB8_SHUFFLE(i) \
+	char(i + FI_RGBA_RED), char(i + FI_RGBA_GREEN), char(i + FI_RGBA_BLUE), char(-1)
+
+TARGET_SSSE3 static void convertRowRGB8_SSSE3(const uint8_t *src, uint8_t *dst, int width)
+{
+	auto shuffle = _mm_setr_epi8(RGB8_SHUFFLE(0), RGB8_SHUFFLE(3), RGB8_SHUFFLE(6), RGB8_SHUFFLE(9));
+	auto alpha = _mm_set1_epi32(int(0xff000000));
+
+	// 16-byte loads of 12 bytes worth of pixels; stop before reading past the row
+	auto x = 0;
+	for (; (x + 8) * 3 + 4 <= width * 3; x += 8) {
+		auto s = src + x * 3;
+		auto d = reinterpret_cast<__m128i *>(dst + x * 4);
+		auto lo = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(s)), shuffle);
+		auto hi = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 12)), shuffle);
+		_mm_storeu_si128(d, _mm_or_si128(lo, alpha));
+		_mm_storeu_si128(d + 1, _mm_or_si128(hi, alpha));
+	}
+
+	convertRowRGB8_Scalar(src + x * 3, dst + x * 4, width - x);
+}
+
+#undef RGB8_SHUFFLE
+
+static void convertRowRGBF_Scalar(const float *src, uint16_t *dst, int width)
+{
+	const auto one = floatToHalf(1.0f);
+	for (auto x = 0; x < width; ++x) {
+		dst[x * 4 + 0] = floatToHalf(src[x * 3 + 0]);
+		dst[x * 4 + 1] = floatToHalf(src[x * 3 + 1]);
+		dst[x * 4 + 2] = floatToHalf(src[x * 3 + 2]);
+		dst[x * 4 + 3] = one;
+	}
+}
+
+TARGET_F16C static void convertRowRGBF_F16C(const float *src, uint16_t *dst, int width)
+{
+	auto one = _mm256_set1_ps(1.0f);
+
+	// Each 4-float load grabs one RGB pixel plus the red of the next, which
+	// gets replaced by alpha. So the last pixel of a row is left to the tail.
+	auto x = 0;
+	for (; x + 8 < width; x += 8) {
+		for (auto i = 0; i < 8; i += 2) {
+			auto lo = _mm_loadu_ps(src + (x + i) * 3);
+			auto hi = _mm_loadu_ps(src + (x + i) * 3 + 3);
+			auto rgba = _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+			rgba = _mm256_blend_ps(rgba, one, 0x88);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + (x + i) * 4), _mm256_cvtps_ph(rgba, 0));
+		}
+	}
+
+	convertRowRGBF_Scalar(src + x * 3, dst + x * 4, width - x);
+}
+
+// Splits four RGB pixels, loaded as three vectors, into one vector per channel
+static inline void deinterleaveRGB(const float *src, __m128 *r, __m128 *g, __m128 *b)
+{
+	auto v0 = _mm_loadu_ps(src);     // r0 g0 b0 r1
+	auto v1 = _mm_loadu_ps(src + 4); // g1 b1 r2 g2
+	auto v2 = _mm_loadu_ps(src + 8); // b2 r3 g3 b3
+
+	*r = _mm_shuffle_ps(v0, _mm_shuffle_ps(v1, v2, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+	*g = _mm_shuffle_ps(_mm_shuffle_ps(v0, v1, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(v1, v2, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+	*b = _mm_shuffle_ps(_mm_shuffle_ps(v0, v1, _MM_SHUFFLE(1, 1, 2, 2)), _mm_shuffle_ps(v2, v2, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+}
+
+static inline uint32_t floatToUnorm10(float value)
+{
+	// written so NaN ends up as zero
+	value = value > 0.0f ? std::min(value, 1.0f) : 0.0f;
+	return uint32_t(lrintf(value * 1023.0f));
+}
+
+static void convertRowRGBFToA2B10G10R10_Scalar(const float *src, uint32_t *dst, int width)
+{
+	for (auto x = 0; x < width; ++x) {
+		dst[x] = floatToUnorm10(src[x * 3 + 0]) |
+		         floatToUnorm10(src[x * 3 + 1]) << 10 |
+		         floatToUnorm10(src[x * 3 + 2]) << 20 |
+		         3u << 30;
+	}
+}
+
+static inline __m128i floatToUnorm10_SSE2(__m128 value)
+{
+	// maxps returns the second operand for NaN
+	value = _mm_min_ps(_mm_max_ps(value, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+	return _mm_cvtps_epi32(_mm_mul_ps(value, _mm_set1_ps(1023.0f)));
+}
+
+static void convertRowRGBFToA2B10G10R10_SSE2(const float *src, uint32_t *dst, int width)
+{
+	auto alpha = _mm_set1_epi32(int(3u << 30));
+
+	auto x = 0;
+	for (; x + 4 <= width; x += 4) {
+		__m128 r, g, b;
+		deinterleaveRGB(src + x * 3, &r, &g, &b);
+
+		auto packed = _mm_or_si128(floatToUnorm10_SSE2(r), alpha);
+		packed = _mm_or_si128(packed, _mm_slli_epi32(floatToUnorm10_SSE2(g), 10));
+		packed = _mm_or_si128(packed, _mm_slli_epi32(floatToUnorm10_SSE2(b), 20));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), packed);
+	}
+
+	convertRowRGBFToA2B10G10R10_Scalar(src + x * 3, dst + x, width - x);
+}
+
+/*
+ * Unsigned floats with a 5-bit exponent, as in B10G11R11_UFLOAT_PACK32. Like
+ * floatToHalf, normal values get their exponent rebiased and are rounded to
+ * nearest even; values below the smallest normal become denormals.
+ */
+template <int mantissaBits>
+static inline uint32_t floatToUnsignedSmallFloat(float value)
+{
+	const auto shift = 23 - mantissaBits;
+	const auto maxValue = 65536.0f - float(1 << (15 - mantissaBits));
+
+	value = value > 0.0f ? std::min(value, maxValue) : 0.0f;
+	if (value < 1.0f / 16384)
+		return uint32_t(lrintf(value * float(1 << (14 + mantissaBits))));
+
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	auto mantissaOdd = (bits >> shift) & 1;
+	bits += (uint32_t(15 - 127) << 23) + (1u << (shift - 1)) - 1 + mantissaOdd;
+	return bits >> shift;
+}
+
+static void convertRowRGBFToB10G11R11_Scalar(const float *src, uint32_t *dst, int width)
+{
+	for (auto x = 0; x < width; ++x) {
+		dst[x] = floatToUnsignedSmallFloat<6>(src[x * 3 + 0]) |
+		         floatToUnsignedSmallFloat<6>(src[x * 3 + 1]) << 11 |
+		         floatToUnsignedSmallFloat<5>(src[x * 3 + 2]) << 22;
+	}
+}
+
+// Same as above, computing both the normal and the denormal encoding and picking one
+template <int mantissaBits>
+static inline __m128i floatToUnsignedSmallFloat_SSE2(__m128 value)
+{
+	const auto shift = 23 - mantissaBits;
+	const auto maxValue = 65536.0f - float(1 << (15 - mantissaBits));
+
+	value = _mm_min_ps(_mm_max_ps(value, _mm_setzero_ps()), _mm_set1_ps(maxValue));
+
+	auto bits = _mm_castps_si128(value);
+	auto mantissaOdd = _mm_and_si128(_mm_srli_epi32(bits, shift), _mm_set1_epi32(1));
+	auto normal = _mm_add_epi32(bits, _mm_set1_epi32(int((uint32_t(15 - 127) << 23) + (1u << (shift - 1)) - 1)));
+	normal = _mm_srli_epi32(_mm_add_epi32(normal, mantissaOdd), shift);
+
+	auto denormal = _mm_cvtps_epi32(_mm_mul_ps(value, _mm_set1_ps(float(1 << (14 + mantissaBits)))));
+	auto isDenormal = _mm_castps_si128(_mm_cmplt_ps(value, _mm_set1_ps(1.0f / 16384)));
+	return _mm_or_si128(_mm_and_si128(isDenormal, denormal), _mm_andnot_si128(isDenormal, normal));
+}
+
+static void convertRowRGBFToB10G11R11_SSE2(const float *src, uint32_t *dst, int width)
+{
+	auto x = 0;
+	for (; x + 4 <= width; x += 4) {
+		__m128 r, g, b;
+		deinterleaveRGB(src + x * 3, &r, &g, &b);
+
+		auto packed = floatToUnsignedSmallFloat_SSE2<6>(r);
+		packed = _mm_or_si128(packed, _mm_slli_epi32(floatToUnsignedSmallFloat_SSE2<6>(g), 11));
+		packed = _mm_or_si128(packed, _mm_slli_epi32(floatToUnsignedSmallFloat_SSE2<5>(b), 22));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), packed);
+	}
+
+	convertRowRGBFToB10G11R11_Scalar(src + x * 3, dst + x, width - x);
+}
+
+static ConvertRowRGBA8Func selectConvertRowRGBA8()
+{
+	if (FI_RGBA_RED == 0 && FI_RGBA_GREEN == 1 && FI_RGBA_BLUE == 2 && FI_RGBA_ALPHA == 3)
+		return convertRowRGBA8_Copy;
+
+	const auto &cpu = getCpuFeatures();
+	if (cpu.avx2)
+		return convertRowRGBA8_AVX2;
+	if (cpu.ssse3)
+		return convertRowRGBA8_SSSE3;
+	return convertRowRGBA8_Scalar;
+}
+
+void convertRowRGBA8(const uint8_t *src, uint8_t *dst, int width)
+{
+	static const auto func = selectConvertRowRGBA8();
+	func(src, dst, width);
+}
+
+void convertRowRGB8(const uint8_t *src, uint8_t *dst, int width)
+{
+	static const auto func = getCpuFeatures().ssse3 ? convertRowRGB8_SSSE3 : convertRowRGB8_Scalar;
+	func(src, dst, width);
+}
+
+void convertRowRGBF(const float *src, uint16_t *dst, int width)
+{
+	static const auto func = getCpuFeatures().f16c ? convertRowRGBF_F16C : convertRowRGBF_Scalar;
+	func(src, dst, width);
+}
+
+void convertRowRGBFToA2B10G10R10(const float *src, uint32_t *dst, int width)
+{
+	convertRowRGBFToA2B10G10R10_SSE2(src, dst, width);
+}
+
+void convertRowRGBFToB10G11R11(const float *src, uint32_t *dst, int width)
+{
+	convertRowRGBFToB10G11R11_SSE2(src, dst, width);
+}
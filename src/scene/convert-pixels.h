@@ -0,0 +1,28 @@
+#ifndef CONVERT_PIXELS_H
+#define CONVERT_PIXELS_H
+
+#include <stdint.h>
+
+/*
+ * Row converters from FreeImage scanlines to texture formats. These pick
+ * SSSE3/AVX2/F16C code paths at runtime, and fall back to scalar code on
+ * CPUs without them. The packed formats only need SSE2.
+ */
+
+// 32-bit FreeImage pixels (in FI_RGBA_* order) to R8G8B8A8
+void convertRowRGBA8(const uint8_t *src, uint8_t *dst, int width);
+
+// 24-bit FreeImage pixels to R8G8B8A8, with alpha set to one
+void convertRowRGB8(const uint8_t *src, uint8_t *dst, int width);
+
+// FIT_RGBF pixels to R16G16B16A16_SFLOAT, with alpha set to one
+void convertRowRGBF(const float *src, uint16_t *dst, int width);
+
+// RGB floats to A2B10G10R10_UNORM_PACK32, clamped to [0, 1], with alpha set to one
+void convertRowRGBFToA2B10G10R10(const float *src, uint32_t *dst, int width);
+
+// RGB floats to B10G11R11_UFLOAT_PACK32. Negative values and NaNs become zero,
+// and large values clamp to the largest finite one.
+void convertRowRGBFToB10G11R11(const float *src, uint32_t *dst, int width);
+
+#endif // CONVERT_PIXELS_H
@@ -0,0 +1,320 @@
+#include "cube-lut.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+using std::runtime_error;
+using std::string;
+using std::vector;
+using std::min;
+using std::max;
+
+struct Cursor {
+	const char *pos, *end;
+	int line;
+};
+
+[[noreturn]] static void parseError(const Cursor &cursor, const char *what)
+{
+	throw runtime_error(string(what) + " on line " + std::to_string(cursor.line));
+}
+
+static bool isBlank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static bool isDigit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static bool isKeywordChar(char c)
+{
+	return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || isDigit(c) || c == '_';
+}
+
+// numbers can't start with anything that starts a keyword, so this is enough
+static bool isKeywordStart(char c)
+{
+	return isKeywordChar(c) && !isDigit(c);
+}
+
+static bool atEndOfLine(const Cursor &cursor)
+{
+	return cursor.pos == cursor.end || *cursor.pos == '\n' || *cursor.pos == '#';
+}
+
+static void skipBlanks(Cursor &cursor)
+{
+	while (cursor.pos != cursor.end && isBlank(*cursor.pos))
+		++cursor.pos;
+}
+
+// leaves the cursor on the newline, so the caller counts it
+static void skipLine(Cursor &cursor)
+{
+	auto newline = memchr(cursor.pos, '\n', size_t(cursor.end - cursor.pos));
+	cursor.pos = newline != nullptr ? static_cast<const char *>(newline) : cursor.end;
+}
+
+static void expectEndOfLine(Cursor &cursor)
+{
+	skipBlanks(cursor);
+	if (!atEndOfLine(cursor))
+		parseError(cursor, "unexpected character");
+}
+
+static double powerOf10(int exponent)
+{
+	// exactly representable as doubles
+	static const double table[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	if (exponent < int(sizeof(table) / sizeof(table[0])))
+		return table[exponent];
+	return pow(10.0, exponent);
+}
+
+/*
+ * Accumulates up to 19 significant digits into an integer, and scales that
+ * by a power of ten in double precision. Rounding to float after that is
+ * more than accurate enough for color values.
+ */
+static float parseFloat(Cursor &cursor)
+{
+	auto p = cursor.pos, end = cursor.end;
+
+	auto negative = false;
+	if (p != end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+
+	uint64_t mantissa = 0;
+	int digits = 0, exponent = 0;
+	auto anyDigits = false;
+
+	for (; p != end && isDigit(*p); ++p) {
+		if (digits < 19) {
+			mantissa = mantissa * 10 + (*p - '0');
+			digits += mantissa != 0;
+		} else
+			++exponent;
+		anyDigits = true;
+	}
+
+	if (p != end && *p == '.') {
+		for (++p; p != end && isDigit(*p); ++p) {
+			if (digits < 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				digits += mantissa != 0;
+				--exponent;
+			}
+			anyDigits = true;
+		}
+	}
+
+	if (!anyDigits)
+		parseError(cursor, "expected number");
+
+	// only an exponent with digits counts as one
+	if (p != end && (*p == 'e' || *p == 'E')) {
+		auto q = p + 1;
+		auto negativeExponent = false;
+		if (q != end && (*q == '-' || *q == '+'))
+			negativeExponent = *q++ == '-';
+
+		if (q != end && isDigit(*q)) {
+			auto value = 0;
+			for (; q != end && isDigit(*q); ++q)
+				value = min(value * 10 + (*q - '0'), 10000);
+			exponent += negativeExponent ? -value : value;
+			p = q;
+		}
+	}
+
+	if (p != end && !isBlank(*p) && *p != '\n' && *p != '#')
+		parseError(cursor, "unexpected character");
+	cursor.pos = p;
+
+	auto value = double(mantissa);
+	if (mantissa != 0) {
+		if (exponent < 0)
+			value /= powerOf10(-exponent);
+		else
+			value *= powerOf10(exponent);
+	}
+	return float(negative ? -value : value);
+}
+
+static int parseInt(Cursor &cursor)
+{
+	if (atEndOfLine(cursor) || !isDigit(*cursor.pos))
+		parseError(cursor, "expected integer");
+
+	auto value = 0;
+	for (; cursor.pos != cursor.end && isDigit(*cursor.pos); ++cursor.pos) {
+		value = value * 10 + (*cursor.pos - '0');
+		if (value > 65536)
+			parseError(cursor, "too large integer");
+	}
+	return value;
+}
+
+static void parseFloats(Cursor &cursor, float *values, int count)
+{
+	for (auto i = 0; i < count; ++i) {
+		skipBlanks(cursor);
+		values[i] = parseFloat(cursor);
+	}
+}
+
+CubeLut parseCubeLut(const char *text, size_t length)
+{
+	CubeLut lut = { 0, { 0.0f, 0.0f, 0.0f }, { 1.0f, 1.0f, 1.0f }, {} };
+	Cursor cursor = { text, text + length, 1 };
+	size_t valuesRead = 0;
+
+	for (;;) {
+		skipBlanks(cursor);
+		if (cursor.pos == cursor.end)
+			break;
+
+		if (*cursor.pos == '\n') {
+			++cursor.pos;
+			++cursor.line;
+			continue;
+		}
+
+		if (*cursor.pos == '#') {
+			skipLine(cursor);
+			continue;
+		}
+
+		if (isKeywordStart(*cursor.pos)) {
+			auto keyword = cursor.pos;
+			while (cursor.pos != cursor.end && isKeywordChar(*cursor.pos))
+				++cursor.pos;
+			auto keywordLength = size_t(cursor.pos - keyword);
+			auto is = [&](const char *name) {
+				return strlen(name) == keywordLength && memcmp(name, keyword, keywordLength) == 0;
+			};
+
+			if (is("TITLE")) {
+				skipLine(cursor); // ignore title
+				continue;
+			}
+
+			if (is("LUT_3D_SIZE")) {
+				if (lut.size != 0)
+					parseError(cursor, "duplicate LUT_3D_SIZE");
+
+				skipBlanks(cursor);
+				lut.size = parseInt(cursor);
+				if (lut.size < 2 || lut.size > 256)
+					parseError(cursor, "unsupported LUT_3D_SIZE");
+
+				lut.colors.resize(size_t(lut.size) * lut.size * lut.size * 3);
+			} else if (is("DOMAIN_MIN"))
+				parseFloats(cursor, lut.domainMin, 3);
+			else if (is("DOMAIN_MAX"))
+				parseFloats(cursor, lut.domainMax, 3);
+			else if (is("LUT_3D_INPUT_RANGE")) {
+				// Resolve's shorthand for the same domain on all axes
+				float range[2];
+				parseFloats(cursor, range, 2);
+				std::fill(lut.domainMin, lut.domainMin + 3, range[0]);
+				std::fill(lut.domainMax, lut.domainMax + 3, range[1]);
+			} else if (is("LUT_1D_SIZE"))
+				parseError(cursor, "1D LUTs are not supported");
+			else
+				parseError(cursor, "unrecognized keyword");
+
+			expectEndOfLine(cursor);
+			continue;
+		}
+
+		if (lut.size == 0)
+			parseError(cursor, "expected LUT_3D_SIZE before color values");
+
+		if (valuesRead == lut.colors.size())
+			parseError(cursor, "too many colors");
+
+		parseFloats(cursor, &lut.colors[valuesRead], 3);
+		valuesRead += 3;
+		expectEndOfLine(cursor);
+	}
+
+	if (lut.size == 0)
+		throw runtime_error("missing LUT_3D_SIZE");
+
+	if (valuesRead != lut.colors.size())
+		throw runtime_error("wrong amount of colors");
+
+	for (auto i = 0; i < 3; ++i)
+		if (!(lut.domainMin[i] < lut.domainMax[i]))
+			throw runtime_error("empty domain");
+
+	return lut;
+}
+
+void resampleToUnitDomain(CubeLut &lut)
+{
+	auto isUnitDomain = true;
+	for (auto i = 0; i < 3; ++i)
+		isUnitDomain = isUnitDomain && lut.domainMin[i] == 0.0f && lut.domainMax[i] == 1.0f;
+	if (isUnitDomain)
+		return;
+
+	auto size = lut.size;
+
+	// where each grid point of the new LUT lands in the old one, per axis
+	vector<int> lower[3];
+	vector<float> weight[3];
+	for (auto axis = 0; axis < 3; ++axis) {
+		auto scale = (size - 1) / (lut.domainMax[axis] - lut.domainMin[axis]);
+		for (auto i = 0; i < size; ++i) {
+			auto t = (float(i) / (size - 1) - lut.domainMin[axis]) * scale;
+			t = min(max(t, 0.0f), float(size - 1));
+			auto index = min(int(t), size - 2);
+			lower[axis].push_back(index);
+			weight[axis].push_back(t - index);
+		}
+	}
+
+	auto at = [&](int r, int g, int b) {
+		return &lut.colors[((size_t(b) * size + g) * size + r) * 3];
+	};
+
+	vector<float> colors(lut.colors.size());
+	auto dst = colors.data();
+	for (auto b = 0; b < size; ++b) {
+		auto b0 = lower[2][b];
+		auto wb = weight[2][b];
+		for (auto g = 0; g < size; ++g) {
+			auto g0 = lower[1][g];
+			auto wg = weight[1][g];
+			for (auto r = 0; r < size; ++r, dst += 3) {
+				auto r0 = lower[0][r];
+				auto wr = weight[0][r];
+				for (auto c = 0; c < 3; ++c) {
+					auto c00 = at(r0, g0, b0)[c]         * (1 - wr) + at(r0 + 1, g0, b0)[c]         * wr;
+					auto c10 = at(r0, g0 + 1, b0)[c]     * (1 - wr) + at(r0 + 1, g0 + 1, b0)[c]     * wr;
+					auto c01 = at(r0, g0, b0 + 1)[c]     * (1 - wr) + at(r0 + 1, g0, b0 + 1)[c]     * wr;
+					auto c11 = at(r0, g0 + 1, b0 + 1)[c] * (1 - wr) + at(r0 + 1, g0 + 1, b0 + 1)[c] * wr;
+					auto c0 = c00 * (1 - wg) + c10 * wg;
+					auto c1 = c01 * (1 - wg) + c11 * wg;
+					dst[c] = c0 * (1 - wb) + c1 * wb;
+				}
+			}
+		}
+	}
+
+	lut.colors.swap(colors);
+	std::fill(lut.domainMin, lut.domainMin + 3, 0.0f);
+	std::fill(lut.domainMax, lut.domainMax + 3, 1.0f);
+}
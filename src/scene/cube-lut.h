@@ -0,0 +1,28 @@
+#ifndef CUBE_LUT_H
+#define CUBE_LUT_H
+
+#include <stddef.h>
+#include <vector>
+
+// A 3D color lookup table, as read from an Adobe/Resolve .CUBE file
+struct CubeLut {
+	int size;
+	float domainMin[3], domainMax[3];
+
+	// size^3 RGB triplets, with red varying fastest
+	std::vector<float> colors;
+};
+
+/*
+ * Parses the text of a .CUBE file. Tokens may be separated by any mix of
+ * spaces and tabs, and lines may end in CRLF. Supports DOMAIN_MIN,
+ * DOMAIN_MAX and LUT_3D_INPUT_RANGE; 1D LUTs are rejected. Numbers are
+ * parsed without going through the C locale.
+ */
+CubeLut parseCubeLut(const char *text, size_t length);
+
+// Resamples lut so its domain is [0, 1] on all axes, which is how shaders
+// index it. Inputs outside the original domain clamp to its edges.
+void resampleToUnitDomain(CubeLut &lut);
+
+#endif // CUBE_LUT_H
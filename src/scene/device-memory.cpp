@@ -0,0 +1,200 @@
+#include "device-memory.h"
+#include "../core/tlsf.h"
+
+#include <memory>
+#include <mutex>
+
+using namespace vulkan;
+
+using std::unique_ptr;
+using std::vector;
+
+struct DeviceMemoryBlock {
+	explicit DeviceMemoryBlock(VkDeviceSize size) : allocator(size)
+	{
+	}
+
+	VkDeviceMemory memory;
+	uint8_t *mappedData;
+	TlsfAllocator allocator;
+};
+
+// per memory type, one pool for buffers and linear images, and one for optimal images
+static vector<unique_ptr<DeviceMemoryBlock>> pools[VK_MAX_MEMORY_TYPES][2];
+static size_t dedicatedCount;
+static VkDeviceSize dedicatedBytes;
+static std::mutex memoryMutex;
+
+static bool isHostVisible(uint32_t memoryTypeIndex)
+{
+	return (deviceMemoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
+}
+
+static bool isCoherent(uint32_t memoryTypeIndex)
+{
+	return (deviceMemoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+}
+
+static VkDeviceSize getBlockSize(uint32_t memoryTypeIndex)
+{
+	// leave room for the other pools on small heaps
+	auto heapIndex = deviceMemoryProperties.memoryTypes[memoryTypeIndex].heapIndex;
+	auto heapSize = deviceMemoryProperties.memoryHeaps[heapIndex].size;
+	auto blockSize = std::min(VkDeviceSize(DEVICE_MEMORY_BLOCK_SIZE), heapSize / 8);
+	return std::max(blockSize & ~VkDeviceSize(TLSF_GRANULARITY - 1), VkDeviceSize(TLSF_GRANULARITY));
+}
+
+static uint8_t *mapWholeMemory(VkDeviceMemory memory, uint32_t memoryTypeIndex)
+{
+	if (!isHostVisible(memoryTypeIndex))
+		return nullptr;
+
+	void *ret;
+	VkResult err = vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &ret);
+	assert(err == VK_SUCCESS);
+	return static_cast<uint8_t *>(ret);
+}
+
+DeviceMemoryAllocation allocateMemory(const VkMemoryRequirements &memoryRequirements, VkMemoryPropertyFlags propertyFlags, bool optimalImage, bool dedicated)
+{
+	auto memoryTypeIndex = getMemoryTypeIndex(memoryRequirements, propertyFlags);
+	auto size = memoryRequirements.size;
+	auto alignment = memoryRequirements.alignment;
+
+	// flushes cover whole atoms, which must not spill into a neighbour
+	auto coherent = isCoherent(memoryTypeIndex);
+	if (isHostVisible(memoryTypeIndex) && !coherent) {
+		auto atomSize = deviceProperties.limits.nonCoherentAtomSize;
+		size = alignSize(size, atomSize);
+		alignment = std::max(alignment, atomSize);
+	}
+
+	DeviceMemoryAllocation allocation = {};
+	allocation.memoryTypeIndex = memoryTypeIndex;
+	allocation.size = size;
+	allocation.coherent = coherent;
+
+	auto blockSize = getBlockSize(memoryTypeIndex);
+	if (dedicated || size > blockSize / 2) {
+		allocation.memory = allocateDeviceMemory(size, memoryTypeIndex);
+		allocation.offset = 0;
+		allocation.mappedData = mapWholeMemory(allocation.memory, memoryTypeIndex);
+
+		std::lock_guard<std::mutex> lock(memoryMutex);
+		++dedicatedCount;
+		dedicatedBytes += size;
+		return allocation;
+	}
+
+	std::lock_guard<std::mutex> lock(memoryMutex);
+
+	auto &pool = pools[memoryTypeIndex][optimalImage ? 1 : 0];
+	for (auto &block : pool) {
+		if (block->allocator.allocate(size, alignment, &allocation.offset)) {
+			allocation.block = block.get();
+			break;
+		}
+	}
+
+	if (allocation.block == nullptr) {
+		auto block = new DeviceMemoryBlock(blockSize);
+		block->memory = allocateDeviceMemory(blockSize, memoryTypeIndex);
+		block->mappedData = mapWholeMemory(block->memory, memoryTypeIndex);
+		pool.emplace_back(block);
+
+		auto allocated = block->allocator.allocate(size, alignment, &allocation.offset);
+		assert(allocated);
+		(void)allocated;
+		allocation.block = block;
+	}
+
+	allocation.memory = allocation.block->memory;
+	if (allocation.block->mappedData != nullptr)
+		allocation.mappedData = allocation.block->mappedData + allocation.offset;
+	return allocation;
+}
+
+void freeMemory(const DeviceMemoryAllocation &allocation)
+{
+	if (allocation.block == nullptr) {
+		// unmapped implicitly
+		vkFreeMemory(device, allocation.memory, nullptr);
+
+		std::lock_guard<std::mutex> lock(memoryMutex);
+		assert(dedicatedCount > 0);
+		--dedicatedCount;
+		dedicatedBytes -= allocation.size;
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(memoryMutex);
+
+	auto block = allocation.block;
+	block->allocator.free(allocation.offset);
+	if (!block->allocator.empty())
+		return;
+
+	// keep the last block around, so a pool doesn't thrash on one allocation coming and going
+	for (auto &pool : pools[allocation.memoryTypeIndex]) {
+		for (auto it = pool.begin(); it != pool.end(); ++it) {
+			if (it->get() != block)
+				continue;
+
+			if (pool.size() > 1) {
+				vkFreeMemory(device, block->memory, nullptr);
+				pool.erase(it);
+			}
+			return;
+		}
+	}
+
+	unreachable("block not in any pool");
+}
+
+void flushMemory(const DeviceMemoryAllocation &allocation, VkDeviceSize offset, VkDeviceSize size)
+{
+	assert(allocation.mappedData != nullptr);
+	assert(offset <= allocation.size);
+
+	if (allocation.coherent)
+		return;
+
+	if (size == VK_WHOLE_SIZE)
+		size = allocation.size - offset;
+	assert(offset + size <= allocation.size);
+
+	// the allocation itself is whole atoms, so rounding outwards stays inside it
+	auto atomSize = deviceProperties.limits.nonCoherentAtomSize;
+	auto begin = (allocation.offset + offset) / atomSize * atomSize;
+	auto end = alignSize(allocation.offset + offset + size, atomSize);
+
+	VkMappedMemoryRange mappedMemoryRange = {};
+	mappedMemoryRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+	mappedMemoryRange.memory = allocation.memory;
+	mappedMemoryRange.offset = begin;
+	mappedMemoryRange.size = end - begin;
+
+	VkResult err = vkFlushMappedMemoryRanges(device, 1, &mappedMemoryRange);
+	assert(err == VK_SUCCESS);
+}
+
+DeviceMemoryStats getMemoryStats()
+{
+	std::lock_guard<std::mutex> lock(memoryMutex);
+
+	DeviceMemoryStats stats = {};
+	for (auto &typePools : pools) {
+		for (auto &pool : typePools) {
+			for (auto &block : pool) {
+				stats.blockCount++;
+				stats.blockBytes += block->allocator.getSize();
+				stats.usedBytes += block->allocator.getUsedSize();
+				stats.allocationCount += block->allocator.getAllocationCount();
+			}
+		}
+	}
+
+	stats.dedicatedCount = dedicatedCount;
+	stats.dedicatedBytes = dedicatedBytes;
+	return stats;
+}
@@ -0,0 +1,42 @@
+#ifndef DEVICE_MEMORY_H
+#define DEVICE_MEMORY_H
+
+#include "../vkinstance.h"
+
+/*
+ * Sub-allocates resource memory from large per-memory-type blocks, so the
+ * number of vkAllocateMemory calls stays far below maxMemoryAllocationCount.
+ *
+ * Buffers and linear images share blocks, while optimal images get blocks
+ * of their own, so neighbours never need bufferImageGranularity padding.
+ * Host-visible blocks are mapped once, for as long as they live.
+ */
+#define DEVICE_MEMORY_BLOCK_SIZE (64 * 1024 * 1024)
+
+struct DeviceMemoryBlock;
+
+struct DeviceMemoryAllocation {
+	VkDeviceMemory memory;
+	VkDeviceSize offset, size;
+	uint8_t *mappedData; // start of the allocation, or nullptr if not host visible
+	DeviceMemoryBlock *block; // nullptr for dedicated allocations
+	uint32_t memoryTypeIndex;
+	bool coherent;
+};
+
+struct DeviceMemoryStats {
+	size_t blockCount, dedicatedCount, allocationCount;
+	VkDeviceSize blockBytes, usedBytes, dedicatedBytes;
+};
+
+// dedicated gives the resource a VkDeviceMemory of its own. Allocations too
+// big to share a block get one anyway.
+DeviceMemoryAllocation allocateMemory(const VkMemoryRequirements &memoryRequirements, VkMemoryPropertyFlags propertyFlags, bool optimalImage, bool dedicated = false);
+void freeMemory(const DeviceMemoryAllocation &allocation);
+
+// Makes host writes visible to the device. Does nothing for coherent memory.
+void flushMemory(const DeviceMemoryAllocation &allocation, VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE);
+
+DeviceMemoryStats getMemoryStats();
+
+#endif // DEVICE_MEMORY_H
@@ -0,0 +1,202 @@
+#include "downsample.h"
+#include "../core/cpu.h"
+#include "../core/half.h"
+#include "../core/parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <immintrin.h>
+
+using std::max;
+using std::min;
+
+/*
+ * Row kernels average two source rows into one destination row of width
+ * pixels, reading source pixels 2x and 2x + 1 for destination pixel x.
+ */
+typedef void (*DownsampleRowFunc)(const uint8_t *row0, const uint8_t *row1, uint8_t *dst, int width);
+
+static void downsampleRowRGBA8(const uint8_t *row0, const uint8_t *row1, uint8_t *dst, int width)
+{
+	for (auto i = 0; i < width * 4; ++i) {
+		auto x = (i / 4) * 8 + i % 4;
+		dst[i] = uint8_t((row0[x] + row0[x + 4] + row1[x] + row1[x + 4] + 2) >> 2);
+	}
+}
+
+// Sums four RGBA8 pixels from each row into two horizontally adjacent
+// 2x2 sums, as 16-bit lanes: [p0 + p1, p2 + p3]
+static inline __m128i sumQuadsRGBA8(__m128i a, __m128i b)
+{
+	auto zero = _mm_setzero_si128();
+	auto lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+	auto hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+	return _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+}
+
+static void downsampleRowRGBA8_SSE2(const uint8_t *row0, const uint8_t *row1, uint8_t *dst, int width)
+{
+	auto round = _mm_set1_epi16(2);
+
+	auto x = 0;
+	for (; x + 4 <= width; x += 4) {
+		auto src0 = reinterpret_cast<const __m128i *>(row0 + x * 8);
+		auto src1 = reinterpret_cast<const __m128i *>(row1 + x * 8);
+		auto s0 = sumQuadsRGBA8(_mm_loadu_si128(src0), _mm_loadu_si128(src1));
+		auto s1 = sumQuadsRGBA8(_mm_loadu_si128(src0 + 1), _mm_loadu_si128(src1 + 1));
+		s0 = _mm_srli_epi16(_mm_add_epi16(s0, round), 2);
+		s1 = _mm_srli_epi16(_mm_add_epi16(s1, round), 2);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x * 4), _mm_packus_epi16(s0, s1));
+	}
+
+	downsampleRowRGBA8(row0 + x * 8, row1 + x * 8, dst + x * 4, width - x);
+}
+
+TARGET_AVX2 static void downsampleRowRGBA8_AVX2(const uint8_t *row0, const uint8_t *row1, uint8_t *dst, int width)
+{
+	auto zero = _mm256_setzero_si256();
+	auto round = _mm256_set1_epi16(2);
+
+	auto x = 0;
+	for (; x + 8 <= width; x += 8) {
+		auto src0 = reinterpret_cast<const __m256i *>(row0 + x * 8);
+		auto src1 = reinterpret_cast<const __m256i *>(row1 + x * 8);
+		__m256i sums[2];
+		for (int i = 0; i < 2; ++i) {
+			// same as sumQuadsRGBA8, but within each 128-bit lane
+			auto a = _mm256_loadu_si256(src0 + i), b = _mm256_loadu_si256(src1 + i);
+			auto lo = _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+			auto hi = _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+			auto sum = _mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi), _mm256_unpackhi_epi64(lo, hi));
+			sums[i] = _mm256_srli_epi16(_mm256_add_epi16(sum, round), 2);
+		}
+		// packing interleaves the lanes, so put the pixel pairs back in order
+		auto packed = _mm256_packus_epi16(sums[0], sums[1]);
+		packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + x * 4), packed);
+	}
+
+	downsampleRowRGBA8_SSE2(row0 + x * 8, row1 + x * 8, dst + x * 4, width - x);
+}
+
+struct SrgbTables {
+	uint16_t toLinear[256]; // 16-bit fixed point
+	uint8_t fromLinear[1 << 16];
+
+	SrgbTables()
+	{
+		for (int i = 0; i < 256; ++i) {
+			auto c = i / 255.0f;
+			auto l = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+			toLinear[i] = uint16_t(l * 65535.0f + 0.5f);
+		}
+
+		for (int i = 0; i < (1 << 16); ++i) {
+			auto l = i / 65535.0f;
+			auto c = l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+			fromLinear[i] = uint8_t(min(max(c, 0.0f), 1.0f) * 255.0f + 0.5f);
+		}
+	}
+};
+
+static const SrgbTables &getSrgbTables()
+{
+	static const SrgbTables tables;
+	return tables;
+}
+
+// Table lookups don't vectorize well, so this one stays scalar
+static void downsampleRowSRGBA8(const uint8_t *row0, const uint8_t *row1, uint8_t *dst, int width)
+{
+	const auto &tables = getSrgbTables();
+	for (auto i = 0; i < width * 4; ++i) {
+		auto x = (i / 4) * 8 + i % 4;
+		if (i % 4 == 3) {
+			// alpha is linear already
+			dst[i] = uint8_t((row0[x] + row0[x + 4] + row1[x] + row1[x + 4] + 2) >> 2);
+			continue;
+		}
+		auto sum = tables.toLinear[row0[x]] + tables.toLinear[row0[x + 4]] +
+		           tables.toLinear[row1[x]] + tables.toLinear[row1[x + 4]];
+		dst[i] = tables.fromLinear[(sum + 2) >> 2];
+	}
+}
+
+static void downsampleRowRGBA16F(const uint8_t *row0, const uint8_t *row1, uint8_t *dst, int width)
+{
+	auto src0 = reinterpret_cast<const uint16_t *>(row0);
+	auto src1 = reinterpret_cast<const uint16_t *>(row1);
+	auto dstHalf = reinterpret_cast<uint16_t *>(dst);
+	for (auto i = 0; i < width * 4; ++i) {
+		auto x = (i / 4) * 8 + i % 4;
+		auto sum = (halfToFloat(src0[x]) + halfToFloat(src0[x + 4])) +
+		           (halfToFloat(src1[x]) + halfToFloat(src1[x + 4]));
+		dstHalf[i] = floatToHalf(sum * 0.25f);
+	}
+}
+
+TARGET_F16C static void downsampleRowRGBA16F_F16C(const uint8_t *row0, const uint8_t *row1, uint8_t *dst, int width)
+{
+	auto quarter = _mm_set1_ps(0.25f);
+	for (auto x = 0; x < width; ++x) {
+		// two adjacent half-float pixels from each row
+		auto src0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + x * 16));
+		auto src1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + x * 16));
+		auto a = _mm_cvtph_ps(src0), b = _mm_cvtph_ps(_mm_srli_si128(src0, 8));
+		auto c = _mm_cvtph_ps(src1), d = _mm_cvtph_ps(_mm_srli_si128(src1, 8));
+		auto avg = _mm_mul_ps(_mm_add_ps(_mm_add_ps(a, b), _mm_add_ps(c, d)), quarter);
+		_mm_storel_epi64(reinterpret_cast<__m128i *>(dst + x * 8), _mm_cvtps_ph(avg, 0));
+	}
+}
+
+static DownsampleRowFunc getDownsampleRowFunc(VkFormat format)
+{
+	switch (format) {
+	case VK_FORMAT_R8G8B8A8_UNORM:
+		return getCpuFeatures().avx2 ? downsampleRowRGBA8_AVX2 : downsampleRowRGBA8_SSE2;
+
+	case VK_FORMAT_R8G8B8A8_SRGB:
+		return downsampleRowSRGBA8;
+
+	case VK_FORMAT_R16G16B16A16_SFLOAT:
+		return getCpuFeatures().f16c ? downsampleRowRGBA16F_F16C : downsampleRowRGBA16F;
+
+	default:
+		throw std::runtime_error("unsupported format for downsampling");
+	}
+}
+
+void downsample(VkFormat format, const void *src, int srcWidth, int srcHeight, void *dst)
+{
+	assert(srcWidth > 0 && srcHeight > 0);
+
+	auto downsampleRow = getDownsampleRowFunc(format);
+	auto pixelSize = size_t(vulkan::getFormatSize(format));
+	auto dstWidth = max(srcWidth / 2, 1),
+	     dstHeight = max(srcHeight / 2, 1);
+	auto srcPitch = srcWidth * pixelSize,
+	     dstPitch = dstWidth * pixelSize;
+
+	// Odd sizes drop the last row or column, like the mip sizes themselves.
+	// A single row or column is averaged with itself.
+	auto srcBytes = static_cast<const uint8_t *>(src);
+	auto dstBytes = static_cast<uint8_t *>(dst);
+	parallelFor(dstHeight, max(16384 / dstWidth, 1), [&](int begin, int end) {
+		for (auto y = begin; y < end; ++y) {
+			auto row0 = srcBytes + srcPitch * (2 * y);
+			auto row1 = srcBytes + srcPitch * min(2 * y + 1, srcHeight - 1);
+			auto dstRow = dstBytes + dstPitch * y;
+
+			if (srcWidth == 1) {
+				uint8_t pair0[32], pair1[32];
+				memcpy(pair0, row0, pixelSize);
+				memcpy(pair0 + pixelSize, row0, pixelSize);
+				memcpy(pair1, row1, pixelSize);
+				memcpy(pair1 + pixelSize, row1, pixelSize);
+				downsampleRow(pair0, pair1, dstRow, 1);
+			} else
+				downsampleRow(row0, row1, dstRow, dstWidth);
+		}
+	});
+}
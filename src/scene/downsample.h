@@ -0,0 +1,14 @@
+#ifndef DOWNSAMPLE_H
+#define DOWNSAMPLE_H
+
+#include "../vkinstance.h"
+
+/*
+ * 2x2 box-filter one mip level into the next. src is srcWidth x srcHeight
+ * tightly packed pixels, dst receives mipSize(srcWidth, 1) x mipSize(srcHeight, 1).
+ * Supports RGBA8 (UNORM, and SRGB which is filtered in linear space) and
+ * RGBA16F. Rows are spread over all cores for large levels.
+ */
+void downsample(VkFormat format, const void *src, int srcWidth, int srcHeight, void *dst);
+
+#endif // DOWNSAMPLE_H
@@ -0,0 +1,148 @@
+#include "flipbook.h"
+#include "upload-batch.h"
+
+#include <algorithm>
+#include <cstring>
+
+using std::unique_lock;
+using std::lock_guard;
+using std::mutex;
+
+Flipbook::Flipbook(const TextureLayout &frameLayout, int frameCount, int windowSize, const FrameDecoder &decodeFrame) :
+	frameLayout(frameLayout),
+	frameCount(frameCount),
+	windowSize(std::min(windowSize, frameCount)),
+	decodeFrame(decodeFrame),
+	residentFrames(std::max(this->windowSize, 0), -1),
+	wantedFrames(std::max(this->windowSize, 0), -1),
+	shownFrame(-1),
+	quit(false)
+{
+	assert(frameLayout.depth == 1 && frameLayout.arrayLayers == 1);
+	assert(frameCount > 0 && windowSize > 0);
+
+	texture.reset(new Texture2DArray(frameLayout.format, frameLayout.width, frameLayout.height, this->windowSize, frameLayout.mipLevels));
+
+	// layers are only copied as their frames come in, but the whole array is bound from the start
+	UploadBatch batch;
+	batch.transitionToShaderRead(texture.get());
+	batch.submit();
+
+	thread = std::thread(&Flipbook::decodeFrames, this);
+}
+
+Flipbook::~Flipbook()
+{
+	{
+		lock_guard<mutex> lock(queueMutex);
+		quit = true;
+	}
+	requestCondition.notify_all();
+	thread.join();
+}
+
+void Flipbook::decodeFrames()
+{
+	for (;;) {
+		DecodedFrame result;
+		{
+			unique_lock<mutex> lock(queueMutex);
+			requestCondition.wait(lock, [&] { return quit || !requests.empty(); });
+			if (quit)
+				return;
+
+			result.frame = requests.front();
+			requests.pop_front();
+		}
+
+		try {
+			result.data.resize(size_t(frameLayout.getSize()));
+			decodeFrame(result.frame, result.data.data());
+		} catch (...) {
+			lock_guard<mutex> lock(queueMutex);
+			error = std::current_exception();
+			decodedCondition.notify_all();
+			return;
+		}
+
+		{
+			lock_guard<mutex> lock(queueMutex);
+			decoded.push_back(std::move(result));
+		}
+		decodedCondition.notify_all();
+	}
+}
+
+int Flipbook::update(int frame, UploadBatch &batch)
+{
+	frame = std::max(0, std::min(frame, frameCount - 1));
+
+	unique_lock<mutex> lock(queueMutex);
+	if (error)
+		std::rethrow_exception(error);
+
+	// Request the window starting at frame. The layer on screen is left
+	// alone until the frame that replaces it is the one to show.
+	auto shownLayer = shownFrame >= 0 ? shownFrame % windowSize : -1;
+	for (auto i = 0; i < windowSize && frame + i < frameCount; ++i) {
+		auto wanted = frame + i;
+		auto layer = wanted % windowSize;
+		if (layer == shownLayer && wanted != frame && residentFrames[layer] == shownFrame)
+			continue;
+
+		if (wantedFrames[layer] != wanted) {
+			wantedFrames[layer] = wanted;
+			if (residentFrames[layer] != wanted)
+				requests.push_back(wanted);
+		}
+	}
+
+	// after seeking, some requests are no longer wanted
+	requests.erase(std::remove_if(requests.begin(), requests.end(), [&](int request) {
+		return wantedFrames[request % windowSize] != request;
+	}), requests.end());
+	requestCondition.notify_one();
+
+	// with nothing to show yet, there's no choice but to wait
+	if (shownFrame < 0) {
+		decodedCondition.wait(lock, [&] {
+			return error || std::any_of(decoded.begin(), decoded.end(), [&](const DecodedFrame &decodedFrame) {
+				return decodedFrame.frame == frame;
+			});
+		});
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+	// uploading may have to wait for staging memory, so don't hold the lock
+	auto ready = std::move(decoded);
+	decoded.clear();
+	lock.unlock();
+
+	for (const auto &decodedFrame : ready) {
+		auto layer = decodedFrame.frame % windowSize;
+		if (wantedFrames[layer] != decodedFrame.frame || residentFrames[layer] == decodedFrame.frame)
+			continue;
+
+		auto staging = batch.allocateStaging(frameLayout.getSize(), vulkan::getFormatSize(frameLayout.format));
+		memcpy(staging.data, decodedFrame.data.data(), decodedFrame.data.size());
+		batch.copyLayer(staging, texture.get(), layer);
+		residentFrames[layer] = decodedFrame.frame;
+	}
+
+	// show the latest resident frame up to this one, or stay put
+	auto best = -1;
+	for (auto residentFrame : residentFrames)
+		if (residentFrame <= frame && residentFrame > best)
+			best = residentFrame;
+
+	if (best >= 0)
+		shownFrame = best;
+	else if (residentFrames[shownFrame % windowSize] != shownFrame) {
+		// seeked back past everything, and the shown layer got replaced
+		shownFrame = *std::max_element(residentFrames.begin(), residentFrames.end());
+	}
+
+	assert(shownFrame >= 0);
+	return shownFrame % windowSize;
+}
@@ -0,0 +1,76 @@
+#ifndef FLIPBOOK_H
+#define FLIPBOOK_H
+
+#include "texture.h"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class UploadBatch;
+
+/*
+ * Streams an image sequence through a Texture2DArray that holds a sliding
+ * window of frames, so memory use doesn't depend on the sequence length.
+ * Frame f lives in array layer f % windowSize. Upcoming frames are decoded
+ * on a background thread, and uploaded into the layers of frames that have
+ * already been shown.
+ */
+class Flipbook {
+public:
+	// Decodes frame into the upload-ready layout of one array layer; runs on
+	// the background thread
+	typedef std::function<void(int frame, void *dst)> FrameDecoder;
+
+	Flipbook(const TextureLayout &frameLayout, int frameCount, int windowSize, const FrameDecoder &decodeFrame);
+	~Flipbook();
+
+	Flipbook(const Flipbook &) = delete;
+	Flipbook &operator=(const Flipbook &) = delete;
+
+	/*
+	 * Uploads whatever has finished decoding into batch, and queues decoding
+	 * of the window starting at frame. Returns the array layer to show; that
+	 * is the last frame up to this one that has been uploaded. Only the first
+	 * call waits for decoding. Submit batch before rendering with the layer.
+	 */
+	int update(int frame, UploadBatch &batch);
+
+	int getFrameCount() const { return frameCount; }
+	Texture2DArray *getTexture() const { return texture.get(); }
+
+private:
+	void decodeFrames();
+
+	struct DecodedFrame {
+		int frame;
+		std::vector<uint8_t> data;
+	};
+
+	std::unique_ptr<Texture2DArray> texture;
+	TextureLayout frameLayout;
+	int frameCount, windowSize;
+	FrameDecoder decodeFrame;
+
+	// per array layer; -1 for none
+	std::vector<int> residentFrames;
+	std::vector<int> wantedFrames;
+	int shownFrame;
+
+	// shared with the background thread
+	std::mutex queueMutex;
+	std::condition_variable requestCondition, decodedCondition;
+	std::deque<int> requests;
+	std::deque<DecodedFrame> decoded;
+	std::exception_ptr error;
+	bool quit;
+
+	std::thread thread;
+};
+
+#endif // FLIPBOOK_H
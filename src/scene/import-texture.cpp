@@ -4,10 +4,23 @@
 #include <stdexcept>
 #include <algorithm>
 #include <vector>
-#include <fstream>
-#include <sstream>
+#include <functional>
+#include <cstring>
+#include <mutex>
 
 #include <sys/stat.h>
+#ifdef WIN32
+#include <direct.h>
+#endif
+
+#include "../core/assetpack.h"
+#include "../core/hash.h"
+#include "../core/parallel.h"
+#include "downsample.h"
+#include "convert-pixels.h"
+#include "block-compress.h"
+#include "upload-batch.h"
+#include "cube-lut.h"
 
 using std::string;
 using std::runtime_error;
@@ -15,11 +28,11 @@ using std::make_unique;
 using std::max;
 using std::vector;
 using std::unique_ptr;
+using std::function;
 
 #include <FreeImage.h>
-#include <immintrin.h>
 
-static FIBITMAP *loadBitmap(string filename, VkFormat *format)
+static FIBITMAP *loadBitmap(string filename, TextureImportFlags flags, VkFormat *format)
 {
 	FREE_IMAGE_FORMAT fif = FreeImage_GetFileType(filename.c_str(), 0);
 	if (fif == FIF_UNKNOWN) {
@@ -39,12 +52,16 @@ static FIBITMAP *loadBitmap(string filename, VkFormat *format)
 	FIBITMAP *temp;
 	switch (imageType) {
 	case FIT_BITMAP:
-		temp = dib;
-		dib = FreeImage_ConvertTo32Bits(dib);
-		FreeImage_Unload(temp);
-		if (!dib)
-			throw runtime_error("failed to convert to 32bits!");
-		*format = VK_FORMAT_R8G8B8A8_UNORM;
+		// copyToMemory expands 24 and 32 bit pixels itself, so only
+		// convert the rest (palettized, 16 bit etc)
+		if (FreeImage_GetBPP(dib) != 24 && FreeImage_GetBPP(dib) != 32) {
+			temp = dib;
+			dib = FreeImage_ConvertTo32Bits(dib);
+			FreeImage_Unload(temp);
+			if (!dib)
+				throw runtime_error("failed to convert to 32bits!");
+		}
+		*format = (flags & TextureImportFlags::SRGB) ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
 		break;
 
 	case FIT_RGBF:
@@ -55,107 +72,142 @@ static FIBITMAP *loadBitmap(string filename, VkFormat *format)
 		throw runtime_error("unsupported image-type!");
 	}
 
-	// FreeImage uses bottom-left origin, we use top-left
-	FreeImage_FlipVertical(dib);
+	// FreeImage uses bottom-left origin, we use top-left. copyToMemory
+	// flips while copying, so the bitmap itself is left as-is.
 	return dib;
 }
 
 static int getBpp(FIBITMAP *dib)
 {
 	switch (FreeImage_GetImageType(dib)) {
-	case FIT_BITMAP: return FreeImage_GetBPP(dib);
+	case FIT_BITMAP: return 32; // expand to RGBA
 	case FIT_RGBF: return sizeof(uint16_t) * 8 * 4; // expand to RGBA, which is always supported
 	default:
 		unreachable("unsupported type!");
 	}
 }
 
-inline uint16_t float_to_half(float input)
+// Reverses the order of the pixels in a converted row
+static void reverseRow(uint8_t *row, int width, int pixelSize)
 {
-	__m128 single = _mm_set_ss(input);
-	__m128i half = _mm_cvtps_ph(single, 0);
-	return static_cast<uint16_t>(_mm_cvtsi128_si32(half));
+	switch (pixelSize) {
+	case 4:
+		std::reverse(reinterpret_cast<uint32_t *>(row), reinterpret_cast<uint32_t *>(row) + width);
+		break;
+	case 8:
+		std::reverse(reinterpret_cast<uint64_t *>(row), reinterpret_cast<uint64_t *>(row) + width);
+		break;
+	default:
+		unreachable("unsupported pixel size!");
+	}
 }
 
-static StagingBuffer *copyToStagingBuffer(FIBITMAP *dib)
+/*
+ * Converts a width x height region of dib, with its top-left corner at
+ * (left, top) counting from the top of the image, into tightly packed rows.
+ * The rows are read in place through the scanline stride, and rotate180
+ * turns the region upside down in the same pass.
+ */
+static void copyRegionToMemory(FIBITMAP *dib, unsigned left, unsigned top, unsigned width, unsigned height, bool rotate180, void *ptr)
 {
 	auto imageType = FreeImage_GetImageType(dib);
-	auto width = FreeImage_GetWidth(dib);
-	auto height = FreeImage_GetHeight(dib);
+	auto imageHeight = FreeImage_GetHeight(dib);
+	assert(left + width <= FreeImage_GetWidth(dib));
+	assert(top + height <= imageHeight);
 
 	auto bpp = getBpp(dib);
 	assert(bpp % 8 == 0);
 	auto pixelSize = bpp / 8;
 
+	auto srcPixelSize = FreeImage_GetBPP(dib) / 8;
 	auto pitch = width * pixelSize;
-	auto size = pitch * height;
-
-	auto stagingBuffer = new StagingBuffer(size);
-	void *ptr = stagingBuffer->map(0, size);
 
 	for (auto y = 0u; y < height; ++y) {
-		auto srcRow = FreeImage_GetScanLine(dib, y);
+		// FreeImage stores the bottom row first
+		auto srcY = top + (rotate180 ? height - 1 - y : y);
+		auto srcRow = FreeImage_GetScanLine(dib, imageHeight - 1 - srcY) + left * srcPixelSize;
 		auto dstRow = static_cast<uint8_t *>(ptr) + pitch * y;
-		FIRGBF *srcRowRGBf;
-		uint16_t *dstRowHalf = (uint16_t *)dstRow;
 
 		switch (imageType) {
 		case FIT_BITMAP:
-			for (auto x = 0u; x < width; ++x) {
-				dstRow[x * 4 + 0] = srcRow[x * 4 + FI_RGBA_RED];
-				dstRow[x * 4 + 1] = srcRow[x * 4 + FI_RGBA_GREEN];
-				dstRow[x * 4 + 2] = srcRow[x * 4 + FI_RGBA_BLUE];
-				dstRow[x * 4 + 3] = srcRow[x * 4 + FI_RGBA_ALPHA];
-			}
+			if (FreeImage_GetBPP(dib) == 24)
+				convertRowRGB8(srcRow, dstRow, int(width));
+			else
+				convertRowRGBA8(srcRow, dstRow, int(width));
 			break;
 		case FIT_RGBF:
-			srcRowRGBf = (FIRGBF *)srcRow;
-			for (auto x = 0u; x < width; ++x) {
-				dstRowHalf[x * 4 + 0] = float_to_half(srcRowRGBf[x].red);
-				dstRowHalf[x * 4 + 1] = float_to_half(srcRowRGBf[x].green);
-				dstRowHalf[x * 4 + 2] = float_to_half(srcRowRGBf[x].blue);
-				dstRowHalf[x * 4 + 3] = float_to_half(1.0f);
-			}
+			static_assert(sizeof(FIRGBF) == 3 * sizeof(float), "unexpected FIRGBF layout");
+			convertRowRGBF(reinterpret_cast<const float *>(srcRow), reinterpret_cast<uint16_t *>(dstRow), int(width));
 			break;
 		default:
 			unreachable("unsupported type!");
 		}
+
+		if (rotate180)
+			reverseRow(dstRow, int(width), int(pixelSize));
 	}
-	stagingBuffer->unmap();
-	return stagingBuffer;
 }
 
-static void uploadMipChain(TextureBase &texture, FIBITMAP *dib, int mipLevels, int arrayLayer = 0)
+static void copyToMemory(FIBITMAP *dib, void *ptr)
 {
-	auto baseWidth = FreeImage_GetWidth(dib);
-	auto baseHeight = FreeImage_GetHeight(dib);
+	copyRegionToMemory(dib, 0, 0, FreeImage_GetWidth(dib), FreeImage_GetHeight(dib), false, ptr);
+}
 
-	for (auto mipLevel = 0; mipLevel < mipLevels; ++mipLevel) {
-		auto mipWidth = TextureBase::mipSize(baseWidth, mipLevel),
-		     mipHeight = TextureBase::mipSize(baseHeight, mipLevel);
+/*
+ * Writes the mip chain of one array layer into memory laid out as described
+ * by layout. copyLevel0 writes the layer's base level to the pointer it gets.
+ */
+static void writeMipChain(const TextureLayout &layout, const function<void(void *)> &copyLevel0, void *ptr, int arrayLayer)
+{
+	auto dst = static_cast<uint8_t *>(ptr);
+	if (layout.mipLevels == 1) {
+		copyLevel0(dst + layout.getSubresourceOffset(0, arrayLayer));
+		return;
+	}
 
+	// ptr is usually write-combined staging memory, which is very slow to
+	// read back. So build each level in cached memory, and copy it over.
+	vector<uint8_t> level(size_t(layout.getLevelSize(0)));
+	vector<uint8_t> nextLevel(size_t(layout.getLevelSize(1)));
+	copyLevel0(level.data());
+
+	for (auto mipLevel = 0; mipLevel < layout.mipLevels; ++mipLevel) {
 		if (mipLevel > 0) {
-			auto temp = dib;
-			dib = FreeImage_Rescale(dib, mipWidth, mipHeight, FILTER_BOX);
-			assert(dib != nullptr);
-			FreeImage_Unload(temp);
+			downsample(layout.format, level.data(),
+			           TextureBase::mipSize(layout.width, mipLevel - 1),
+			           TextureBase::mipSize(layout.height, mipLevel - 1),
+			           nextLevel.data());
+			level.swap(nextLevel);
 		}
 
-		assert(FreeImage_GetWidth(dib) == mipWidth);
-		assert(FreeImage_GetHeight(dib) == mipHeight);
-
-		auto stagingBuffer = copyToStagingBuffer(dib);
-		texture.uploadFromStagingBuffer(stagingBuffer, mipLevel, arrayLayer);
-		// TODO: delete staging buffer
+		auto offset = layout.getSubresourceOffset(mipLevel, arrayLayer);
+		memcpy(dst + offset, level.data(), size_t(layout.getLevelSize(mipLevel)));
 	}
+}
+
+// Same as above, for all of dib; this unloads dib
+static void writeMipChain(const TextureLayout &layout, FIBITMAP *dib, void *ptr, int arrayLayer = 0)
+{
+	assert(FreeImage_GetWidth(dib) == unsigned(layout.width));
+	assert(FreeImage_GetHeight(dib) == unsigned(layout.height));
 
+	writeMipChain(layout, [&](void *level0) {
+		copyToMemory(dib, level0);
+	}, ptr, arrayLayer);
 	FreeImage_Unload(dib);
 }
 
-unique_ptr<Texture2D> importTexture2D(const string &filename, TextureImportFlags flags)
+/*
+ * The load-functions below decode a source asset, and call allocate once the
+ * final layout is known. The memory it returns receives the whole mip chain,
+ * which lets the same code fill a mapped staging buffer or a cooked asset.
+ */
+typedef function<void *(const TextureLayout &layout)> TextureAllocator;
+
+static void loadTexture2D(const string &filename, TextureImportFlags flags, const TextureAllocator &allocate)
 {
 	VkFormat format = VK_FORMAT_UNDEFINED;
-	auto dib = loadBitmap(filename, &format);
+	auto dib = loadBitmap(filename, flags, &format);
 	assert(format != VK_FORMAT_UNDEFINED);
 
 	if (flags & TextureImportFlags::PREMULTIPLY_ALPHA)
@@ -168,67 +220,116 @@ unique_ptr<Texture2D> importTexture2D(const string &filename, TextureImportFlags
 	if (flags & TextureImportFlags::GENERATE_MIPMAPS)
 		mipLevels = TextureBase::maxMipLevels(max(baseWidth, baseHeight));
 
-	auto texture = make_unique<Texture2D>(format, baseWidth, baseHeight, mipLevels, 1, true);
-	uploadMipChain(*texture, dib, mipLevels);
+	TextureLayout layout = { format, int(baseWidth), int(baseHeight), 1, mipLevels, 1 };
+	writeMipChain(layout, dib, allocate(layout));
+}
+
+static string getArrayLayerPath(const string &folder, int arrayLayer)
+{
+	char path[256];
+	snprintf(path, sizeof(path), "%s/%04d.png", folder.c_str(), arrayLayer);
+	return path;
+}
 
-	return texture;
+static bool isRegularFile(const string &path)
+{
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 && (st.st_mode & S_IFMT) == S_IFREG;
 }
 
-unique_ptr<Texture2DArray> importTexture2DArray(const string &folder, TextureImportFlags flags)
+static int countArrayLayers(const string &folder)
 {
-	VkFormat firstFormat = VK_FORMAT_UNDEFINED;
-	unsigned int firstWidth, firstHeight;
+	int arrayLayers = 0;
+	while (isRegularFile(getArrayLayerPath(folder, arrayLayers)))
+		++arrayLayers;
 
-	vector<FIBITMAP *> bitmaps;
-	for (int i = 0; true; ++i) {
-		char path[256];
-		snprintf(path, sizeof(path), "%s/%04d.png", folder.c_str(), i);
+	if (arrayLayers == 0)
+		throw runtime_error("empty texture-array!");
 
-		struct stat st;
-		if ((stat(path, &st) < 0) ||
-		    (st.st_mode & S_IFMT) != S_IFREG)
-			break;
+	return arrayLayers;
+}
 
-		VkFormat format = VK_FORMAT_UNDEFINED;
-		auto dib = loadBitmap(path, &format);
+static FIBITMAP *loadArrayLayer(const string &folder, int arrayLayer, TextureImportFlags flags, VkFormat *format)
+{
+	auto dib = loadBitmap(getArrayLayerPath(folder, arrayLayer), flags, format);
+	if (flags & TextureImportFlags::PREMULTIPLY_ALPHA)
+		FreeImage_PreMultiplyWithAlpha(dib);
+	return dib;
+}
 
-		auto width = FreeImage_GetWidth(dib);
-		auto height = FreeImage_GetHeight(dib);
+// The layout of one layer; the other layers must match it
+static TextureLayout getArrayLayerLayout(FIBITMAP *dib, VkFormat format, TextureImportFlags flags)
+{
+	auto width = FreeImage_GetWidth(dib);
+	auto height = FreeImage_GetHeight(dib);
 
-		if (i == 0) {
-			firstFormat = format;
-			firstWidth = width;
-			firstHeight = height;
-		} else if (firstFormat != format ||
-		           firstWidth != width ||
-		           firstHeight != height)
-			throw runtime_error("inconsistent format or size!");
+	auto mipLevels = 1;
+	if (flags & TextureImportFlags::GENERATE_MIPMAPS)
+		mipLevels = TextureBase::maxMipLevels(max(width, height));
 
-		if (flags & TextureImportFlags::PREMULTIPLY_ALPHA)
-			FreeImage_PreMultiplyWithAlpha(dib);
+	TextureLayout layout = { format, int(width), int(height), 1, mipLevels, 1 };
+	return layout;
+}
 
-		bitmaps.push_back(dib);
+static void checkArrayLayer(const TextureLayout &layout, FIBITMAP *dib, VkFormat format)
+{
+	if (format != layout.format ||
+	    FreeImage_GetWidth(dib) != unsigned(layout.width) ||
+	    FreeImage_GetHeight(dib) != unsigned(layout.height)) {
+		FreeImage_Unload(dib);
+		throw runtime_error("inconsistent format or size!");
 	}
+}
 
-	if (bitmaps.size() == 0)
-		throw runtime_error("empty texture-array!");
+/*
+ * Decodes layers [1, arrayLayers) on all cores, and hands each one to
+ * writeLayer as soon as it's decoded, which unloads it. At most maxInFlight
+ * layers are between starting to decode and writeLayer returning.
+ */
+static void decodeArrayLayers(const string &folder, TextureImportFlags flags, const TextureLayout &layout, int arrayLayers, int maxInFlight,
+                              const function<void(int arrayLayer, FIBITMAP *dib)> &writeLayer)
+{
+	CountingSemaphore inFlight(max(maxInFlight, 1));
+	parallelFor(arrayLayers - 1, 1, [&](int begin, int end) {
+		for (auto arrayLayer = begin + 1; arrayLayer < end + 1; ++arrayLayer) {
+			inFlight.acquire();
+			try {
+				VkFormat layerFormat = VK_FORMAT_UNDEFINED;
+				auto dib = loadArrayLayer(folder, arrayLayer, flags, &layerFormat);
+				checkArrayLayer(layout, dib, layerFormat);
+				writeLayer(arrayLayer, dib);
+			} catch (...) {
+				inFlight.release();
+				throw;
+			}
+			inFlight.release();
+		}
+	});
+}
 
-	auto mipLevels = 1;
-	if (flags & TextureImportFlags::GENERATE_MIPMAPS)
-		mipLevels = TextureBase::maxMipLevels(max(firstWidth, firstHeight));
+static void loadTexture2DArray(const string &folder, TextureImportFlags flags, const TextureAllocator &allocate)
+{
+	auto arrayLayers = countArrayLayers(folder);
 
-	assert(bitmaps.size() < INT_MAX);
-	auto texture = make_unique<Texture2DArray>(firstFormat, firstWidth, firstHeight, int(bitmaps.size()), mipLevels, true);
-	for (int i = 0; i < texture->getArrayLayers(); ++i)
-		uploadMipChain(*texture, bitmaps[i], mipLevels, i);
+	// the first layer decides the format and size for the rest
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	auto dib = loadArrayLayer(folder, 0, flags, &format);
+	auto layout = getArrayLayerLayout(dib, format, flags);
+	layout.arrayLayers = arrayLayers;
 
-	return texture;
+	auto ptr = allocate(layout);
+	writeMipChain(layout, dib, ptr, 0);
+
+	// each thread writes straight into ptr, so one decoded bitmap per thread is all there is
+	decodeArrayLayers(folder, flags, layout, arrayLayers, arrayLayers, [&](int arrayLayer, FIBITMAP *dib) {
+		writeMipChain(layout, dib, ptr, arrayLayer);
+	});
 }
 
-unique_ptr<TextureCube> importTextureCube(const string &filename, TextureImportFlags flags)
+static void loadTextureCube(const string &filename, TextureImportFlags flags, const TextureAllocator &allocate)
 {
 	VkFormat format = VK_FORMAT_UNDEFINED;
-	auto dib = loadBitmap(filename, &format);
+	auto dib = loadBitmap(filename, flags, &format);
 	assert(format != VK_FORMAT_UNDEFINED);
 
 	auto imageWidth = FreeImage_GetWidth(dib);
@@ -246,123 +347,598 @@ unique_ptr<TextureCube> importTextureCube(const string &filename, TextureImportF
 	if (flags & TextureImportFlags::GENERATE_MIPMAPS)
 		mipLevels = TextureBase::maxMipLevels(baseSize);
 
-	auto texture = make_unique<TextureCube>(format, baseSize, mipLevels);
+	TextureLayout layout = { format, int(baseSize), int(baseSize), 1, mipLevels, 6 };
+	auto ptr = allocate(layout);
 
+	// face positions, counting from the top of the image
 	static const int offsets[6][2] = {
-		{ 2, 2 }, // -X
-		{ 0, 2 }, // +X
-		{ 1, 3 }, // +Y
-		{ 1, 1 }, // -Y
-		{ 1, 2 }, // +Z
-		{ 1, 0 }, // -Z - this one is upside down :(
+		{ 2, 1 }, // -X
+		{ 0, 1 }, // +X
+		{ 1, 0 }, // +Y
+		{ 1, 2 }, // -Y
+		{ 1, 1 }, // +Z
+		{ 1, 3 }, // -Z - this one is upside down :(
 	};
-	for (auto face = 0; face < 6; ++face) {
-		auto left = offsets[face][0] * baseSize,
-		     top  = offsets[face][1] * baseSize;
-		auto faceDib = FreeImage_Copy(dib, left, top, left + baseSize, top + baseSize);
-
-		if (face == 5) {
-			FreeImage_FlipVertical(faceDib);
-			FreeImage_FlipHorizontal(faceDib);
+
+	// faces are read straight out of the cross, and only read from dib
+	parallelFor(6, 1, [&](int begin, int end) {
+		for (auto face = begin; face < end; ++face) {
+			auto left = offsets[face][0] * baseSize,
+			     top  = offsets[face][1] * baseSize;
+			writeMipChain(layout, [&](void *level0) {
+				copyRegionToMemory(dib, left, top, baseSize, baseSize, face == 5, level0);
+			}, ptr, face);
 		}
+	});
+
+	FreeImage_Unload(dib);
+}
+
+static void loadCubeFile(const string &filename, VkFormat format, const TextureAllocator &allocate)
+{
+	MemoryMappedFile file(filename, MAP_HINT_SEQUENTIAL);
+	auto lut = parseCubeLut(static_cast<const char *>(file.getData()), file.getSize());
+	resampleToUnitDomain(lut);
 
-		uploadMipChain(*texture, faceDib, mipLevels, face);
+	TextureLayout layout = { format, lut.size, lut.size, lut.size, 1, 1 };
+	auto colorCount = int(lut.colors.size() / 3);
+
+	switch (format) {
+	case VK_FORMAT_R16G16B16A16_SFLOAT:
+		convertRowRGBF(lut.colors.data(), static_cast<uint16_t *>(allocate(layout)), colorCount);
+		break;
+	case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+		convertRowRGBFToA2B10G10R10(lut.colors.data(), static_cast<uint32_t *>(allocate(layout)), colorCount);
+		break;
+	case VK_FORMAT_B10G11R11_UFLOAT_PACK32:
+		convertRowRGBFToB10G11R11(lut.colors.data(), static_cast<uint32_t *>(allocate(layout)), colorCount);
+		break;
+	default:
+		throw runtime_error("unsupported LUT format!");
 	}
+}
 
-	FreeImage_Unload(dib);
-	return texture;
+
+static Texture2D *createTexture2D(const TextureLayout &layout)
+{
+	return new Texture2D(layout.format, layout.width, layout.height, layout.mipLevels, 1, true);
 }
 
-unique_ptr<Texture3D> importCubeFile(const std::string &filename)
+static Texture2DArray *createTexture2DArray(const TextureLayout &layout)
 {
-	int size;
+	return new Texture2DArray(layout.format, layout.width, layout.height, layout.arrayLayers, layout.mipLevels, true);
+}
 
-	StagingBuffer *stagingBuffer = nullptr;
-	float *ptr = nullptr;
-	int colorsRead = 0;
+static TextureCube *createTextureCube(const TextureLayout &layout)
+{
+	assert(layout.width == layout.height && layout.arrayLayers == 6);
+	return new TextureCube(layout.format, layout.width, layout.mipLevels);
+}
 
-	std::ifstream stream(filename);
-	std::string line;
-	while (getline(stream, line)) {
-		if (line.empty() || line[0] == '#')
-			continue;
+static Texture3D *createTexture3D(const TextureLayout &layout)
+{
+	return new Texture3D(layout.format, layout.width, layout.height, layout.depth, layout.mipLevels);
+}
 
-		if (isalpha(line[0])) {
-			auto sep = line.find(" ");
-			auto verb = line.substr(0, sep);
+typedef function<void(const TextureAllocator &allocate)> TextureLoader;
 
-			if (verb == "TITLE")
-				continue; // ignore title
+// Block compression needs every level on the CPU, so it wins over GPU_MIPMAPS
+static bool useGpuMipmaps(TextureImportFlags flags)
+{
+	return (flags & TextureImportFlags::GENERATE_MIPMAPS) && (flags & TextureImportFlags::GPU_MIPMAPS) &&
+	       !(flags & TextureImportFlags::COMPRESS);
+}
 
-			if (verb == "LUT_3D_SIZE") {
-				auto sizeString = line.substr(sep + 1);
+// The flags to load with; GPU-generated mipmaps only need mip 0 from the CPU
+static TextureImportFlags getLoadFlags(TextureImportFlags flags)
+{
+	if (useGpuMipmaps(flags))
+		return static_cast<TextureImportFlags>(flags & ~TextureImportFlags::GENERATE_MIPMAPS);
+	return flags;
+}
 
-				char *end = nullptr;
-				size = strtol(sizeString.c_str(), &end, 10);
-				if (end == nullptr)
-					throw runtime_error("expected integer size");
+static UploadBatch *uploadBatch = nullptr;
 
-				auto textureSize = sizeof(float) * 4 * size * size * size;
-				stagingBuffer = new StagingBuffer(textureSize);
-				ptr = static_cast<float *>(stagingBuffer->map(0, textureSize));
+void setTextureUploadBatch(UploadBatch *batch)
+{
+	uploadBatch = batch;
+}
 
-				continue;
+/*
+ * Runs load straight into a mapped staging buffer, and uploads the result.
+ * With generateMipmaps, load provides mip 0 and the GPU builds the rest,
+ * unless the format can't be blitted. Then mip 0 goes to cached memory, and
+ * the levels are downsampled on the CPU instead.
+ */
+template <typename T>
+static unique_ptr<T> importTexture(const TextureLoader &load, T *(*create)(const TextureLayout &), bool generateMipmaps = false)
+{
+	UploadBatch localBatch;
+	auto &batch = uploadBatch ? *uploadBatch : localBatch;
+
+	unique_ptr<T> texture;
+	StagingRegion staging = {};
+	TextureLayout baseLayout = {}, textureLayout = {};
+	vector<uint8_t> baseLevel;
+
+	try {
+		load([&](const TextureLayout &layout) {
+			assert(!texture);
+
+			textureLayout = layout;
+			if (generateMipmaps) {
+				assert(layout.mipLevels == 1);
+				textureLayout.mipLevels = TextureBase::maxMipLevels(max(max(layout.width, layout.height), layout.depth));
 			}
 
-			if (verb == "DOMAIN_MIN") {
-				if (line != "DOMAIN_MIN 0.0 0.0 0.0")
-					throw runtime_error("expected DOMAIN_MIN");
-				continue;
-			}
+			texture.reset(create(textureLayout));
 
-			if (verb == "DOMAIN_MAX") {
-				if (line != "DOMAIN_MAX 1.0 1.0 1.0")
-					throw runtime_error("expected DOMAIN_MAX");
-				continue;
+			if (generateMipmaps && !TextureBase::canGenerateMipmaps(layout.format)) {
+				assert(layout.depth == 1);
+				baseLayout = layout;
+				baseLevel.resize(size_t(layout.getSize()));
+				staging = batch.allocateStaging(textureLayout.getSize(), vulkan::getFormatSize(layout.format));
+				return static_cast<void *>(baseLevel.data());
 			}
 
-			throw runtime_error("unrecognized verb");
+			staging = batch.allocateStaging(layout.getSize(), vulkan::getFormatSize(layout.format));
+			return staging.data;
+		});
+
+		if (!baseLevel.empty()) {
+			for (auto arrayLayer = 0; arrayLayer < textureLayout.arrayLayers; ++arrayLayer)
+				writeMipChain(textureLayout, [&](void *level0) {
+					memcpy(level0, baseLevel.data() + baseLayout.getSubresourceOffset(0, arrayLayer), size_t(textureLayout.getLevelSize(0)));
+				}, staging.data, arrayLayer);
+			generateMipmaps = false;
 		}
+	} catch (...) {
+		// a shared batch lives on, and would keep the half-written staging pinned
+		if (staging.data)
+			batch.releaseStaging(staging);
+		throw;
+	}
 
-		if (isdigit(line[0])) {
-			if (ptr == nullptr)
-				throw runtime_error("expected size before color values");
+	assert(texture && staging.data);
+	batch.copyMipChain(staging, texture.get(), generateMipmaps);
+	localBatch.submit();
+	return texture;
+}
 
-			std::stringstream ss(line);
+// Uploads a texture that's already laid out for upload
+template <typename T>
+static unique_ptr<T> importTexture(const TextureLayout &layout, const void *data, T *(*create)(const TextureLayout &), bool generateMipmaps = false)
+{
+	return importTexture<T>([&](const TextureAllocator &allocate) {
+		memcpy(allocate(layout), data, size_t(layout.getSize()));
+	}, create, generateMipmaps);
+}
 
-			float r = 0, g = 0, b = 0;
+// Throws unless name is a well-formed texture asset of viewType
+static const AssetPackEntry &getTextureEntry(const AssetPack &pack, const string &name, VkImageViewType viewType, TextureLayout *layout)
+{
+	const auto &entry = pack.getEntry(name);
+	if (entry.type != ASSET_PACK_TEXTURE ||
+	    entry.texture.viewType != uint32_t(viewType))
+		throw runtime_error("unexpected asset type: " + name);
+
+	*layout = {
+		VkFormat(entry.texture.format),
+		entry.texture.width, entry.texture.height, entry.texture.depth,
+		entry.texture.mipLevels, entry.texture.arrayLayers
+	};
 
-			ss >> r;
-			if (ss.peek() != ' ')
-				throw runtime_error("unexpected character");
-			ss.ignore();
+	if (layout->width <= 0 || layout->height <= 0 || layout->depth <= 0 ||
+	    layout->mipLevels <= 0 || layout->arrayLayers <= 0 ||
+	    layout->getSize() != entry.size)
+		throw runtime_error("corrupt texture asset: " + name);
 
-			ss >> g;
-			if (ss.peek() != ' ')
-				throw runtime_error("unexpected character");
-			ss.ignore();
+	return entry;
+}
 
-			ss >> b;
+template <typename T>
+static unique_ptr<T> importTexture(const AssetPack &pack, const string &name, VkImageViewType viewType, T *(*create)(const TextureLayout &), bool generateMipmaps = false)
+{
+	TextureLayout layout;
+	const auto &entry = getTextureEntry(pack, name, viewType, &layout);
+	return importTexture(layout, pack.getData(entry), create, generateMipmaps);
+}
 
-			if (!ss.eof())
-				throw runtime_error("unexpected character");
+static bool hasAlpha(const TextureLayout &layout, const uint8_t *data)
+{
+	assert(vulkan::getFormatSize(layout.format) == 4);
+	auto size = layout.getSubresourceOffset(1);
+	for (VkDeviceSize i = 3; i < size; i += 4)
+		if (data[i] != 0xff)
+			return true;
+	return false;
+}
 
-			ptr[colorsRead * 4 + 0] = r;
-			ptr[colorsRead * 4 + 1] = g;
-			ptr[colorsRead * 4 + 2] = b;
-			ptr[colorsRead * 4 + 3] = 1.0f;
-			++colorsRead;
-			continue;
-		}
+static VkFormat getCompressedFormat(const TextureLayout &layout, const uint8_t *data, TextureImportFlags flags)
+{
+	if (layout.depth != 1)
+		return layout.format;
+
+	auto srgb = layout.format == VK_FORMAT_R8G8B8A8_SRGB;
+	switch (layout.format) {
+	case VK_FORMAT_R16G16B16A16_SFLOAT:
+		return VK_FORMAT_BC6H_UFLOAT_BLOCK;
+
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+		if (flags & TextureImportFlags::NORMAL_MAP)
+			return VK_FORMAT_BC5_UNORM_BLOCK;
+		if (flags & TextureImportFlags::SINGLE_CHANNEL)
+			return VK_FORMAT_BC4_UNORM_BLOCK;
+		if (flags & TextureImportFlags::COMPRESS_HIGH_QUALITY)
+			return srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+		if (hasAlpha(layout, data))
+			return srgb ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK;
+		return srgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
 
-		throw runtime_error("unrecognized line");
+	default:
+		return layout.format;
 	}
+}
 
-	if (colorsRead != size * size * size)
-		throw runtime_error("wrong amount of colors");
+// BC formats need the device feature, so drop COMPRESS up front when it's
+// missing. That also keeps the texture cache from serving compressed data.
+static TextureImportFlags getDeviceImportFlags(TextureImportFlags flags)
+{
+	if (!vulkan::enabledFeatures.textureCompressionBC)
+		return static_cast<TextureImportFlags>(flags & ~TextureImportFlags::COMPRESS);
+	return flags;
+}
+
+// With checkDevice, formats the device can't sample fall back to layout.format
+static VkFormat getImportFormat(const TextureLayout &layout, const uint8_t *data, TextureImportFlags flags, bool checkDevice)
+{
+	auto format = getCompressedFormat(layout, data, flags);
+	if (checkDevice && format != layout.format)
+		format = vulkan::findBestFormat({ format, layout.format }, VK_IMAGE_TILING_OPTIMAL,
+			VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT);
+	return format;
+}
+
+// Block-compresses the mip chain in data to format, or copies it if that's layout.format
+static void compressMipChain(const TextureLayout &layout, const uint8_t *data, VkFormat format, TextureImportFlags flags, uint8_t *dst)
+{
+	if (format == layout.format) {
+		memcpy(dst, data, size_t(layout.getSize()));
+		return;
+	}
+
+	auto compressedLayout = layout;
+	compressedLayout.format = format;
+
+	auto highQuality = (flags & TextureImportFlags::COMPRESS_HIGH_QUALITY) != 0;
+	for (auto mipLevel = 0; mipLevel < layout.mipLevels; ++mipLevel)
+		for (auto arrayLayer = 0; arrayLayer < layout.arrayLayers; ++arrayLayer)
+			blockCompress(format,
+			              data + layout.getSubresourceOffset(mipLevel, arrayLayer),
+			              TextureBase::mipSize(layout.width, mipLevel),
+			              TextureBase::mipSize(layout.height, mipLevel),
+			              dst + compressedLayout.getSubresourceOffset(mipLevel, arrayLayer),
+			              highQuality);
+}
+
+/*
+ * Wraps load so its output gets block-compressed as flags ask for. The
+ * uncompressed mip chain is decoded to memory first, as compression reads
+ * it back.
+ */
+static TextureLoader compressTexture(const TextureLoader &load, TextureImportFlags flags, bool checkDevice)
+{
+	if (!(flags & TextureImportFlags::COMPRESS))
+		return load;
+
+	return [=](const TextureAllocator &allocate) {
+		TextureLayout layout = {};
+		vector<uint8_t> data;
+		load([&](const TextureLayout &textureLayout) {
+			layout = textureLayout;
+			data.resize(size_t(layout.getSize()));
+			return static_cast<void *>(data.data());
+		});
+
+		auto compressedLayout = layout;
+		compressedLayout.format = getImportFormat(layout, data.data(), flags, checkDevice);
+		compressMipChain(layout, data.data(), compressedLayout.format, flags, static_cast<uint8_t *>(allocate(compressedLayout)));
+	};
+}
+
+// Runs load into memory, and returns the layout it picked
+static TextureLayout decodeTexture(const TextureLoader &load, vector<uint8_t> *data)
+{
+	TextureLayout layout = {};
+	load([&](const TextureLayout &textureLayout) {
+		layout = textureLayout;
+		data->resize(size_t(layout.getSize()));
+		return static_cast<void *>(data->data());
+	});
+	return layout;
+}
+
+static void addTexture(AssetPackWriter &writer, const string &name, VkImageViewType viewType, const TextureLayout &layout, const vector<uint8_t> &data)
+{
+	AssetPackTextureInfo info = {
+		uint32_t(layout.format), uint32_t(viewType),
+		layout.width, layout.height, layout.depth,
+		layout.mipLevels, layout.arrayLayers
+	};
+	writer.addTexture(name, info, data.data(), data.size());
+}
+
+static void cookTexture(AssetPackWriter &writer, const string &name, VkImageViewType viewType, const TextureLoader &load)
+{
+	vector<uint8_t> data;
+	auto layout = decodeTexture(load, &data);
+	addTexture(writer, name, viewType, layout, data);
+}
+
+/*
+ * Decoded textures are cached as single-entry asset packs, named after a hash
+ * of the source file contents and everything that affects the result. Bump
+ * TEXTURE_CACHE_VERSION whenever the import processing changes.
+ */
+#define TEXTURE_CACHE_VERSION 3
+
+static string textureCacheDirectory = "data/cache";
+
+void setTextureCacheDirectory(const string &path)
+{
+	textureCacheDirectory = path;
+}
+
+static string getTextureCachePath(const string &filename, TextureImportFlags flags, VkImageViewType viewType, VkFormat format)
+{
+	MemoryMappedFile file(filename, MAP_HINT_SEQUENTIAL | MAP_HINT_PREFETCH);
+
+	struct {
+		uint64_t contentHash;
+		uint32_t flags;
+		uint32_t viewType;
+		uint32_t format;
+		uint32_t padding;
+	} key = {
+		hash64(file.getData(), file.getSize()),
+		uint32_t(flags), uint32_t(viewType), uint32_t(format), 0
+	};
+
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.pack",
+	         (unsigned long long)hash64(&key, sizeof(key), TEXTURE_CACHE_VERSION));
+	return textureCacheDirectory + "/" + name;
+}
+
+// format is part of the key for loaders that convert to a format picked by the caller
+template <typename T>
+static unique_ptr<T> importTextureCached(const string &filename, TextureImportFlags flags, VkImageViewType viewType, const TextureLoader &load, T *(*create)(const TextureLayout &), VkFormat format = VK_FORMAT_UNDEFINED)
+{
+	auto generateMipmaps = useGpuMipmaps(flags);
+	if (textureCacheDirectory.empty())
+		return importTexture(load, create, generateMipmaps);
+
+	auto cachePath = getTextureCachePath(filename, flags, viewType, format);
+
+	// only a missing or corrupt cache entry is rebuilt, upload failures are passed on
+	unique_ptr<AssetPack> pack;
+	TextureLayout layout;
+	const AssetPackEntry *entry = nullptr;
+	try {
+		pack = make_unique<AssetPack>(cachePath);
+		entry = &getTextureEntry(*pack, "texture", viewType, &layout);
+	} catch (const runtime_error &) {
+		pack.reset();
+	}
+
+	if (pack)
+		return importTexture(layout, pack->getData(*entry), create, generateMipmaps);
+
+#ifdef WIN32
+	_mkdir(textureCacheDirectory.c_str());
+#else
+	mkdir(textureCacheDirectory.c_str(), 0777);
+#endif
+
+	vector<uint8_t> data;
+	layout = decodeTexture(load, &data);
+
+	AssetPackWriter writer;
+	addTexture(writer, "texture", viewType, layout, data);
+	try {
+		writer.write(cachePath);
+	} catch (const runtime_error &) {
+		// the cache is best-effort, and data is all the upload needs
+	}
+
+	return importTexture(layout, data.data(), create, generateMipmaps);
+}
+
+unique_ptr<Texture2D> importTexture2D(const string &filename, TextureImportFlags flags)
+{
+	flags = getDeviceImportFlags(flags);
+	return importTextureCached(filename, flags, VK_IMAGE_VIEW_TYPE_2D, compressTexture([&](const TextureAllocator &allocate) {
+		loadTexture2D(filename, getLoadFlags(flags), allocate);
+	}, flags, true), createTexture2D);
+}
+
+/*
+ * Unlike the other imports, this never holds the whole array: every layer
+ * gets its own staging, and its copy is recorded as soon as it's written.
+ * Layers copy one at a time, so mipmaps are always built on the CPU.
+ */
+unique_ptr<Texture2DArray> importTexture2DArray(const string &folder, TextureImportFlags flags)
+{
+	flags = getDeviceImportFlags(flags);
+	auto arrayLayers = countArrayLayers(folder);
+
+	// the first layer decides the format and size for the rest, and whether to compress with alpha
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	auto dib = loadArrayLayer(folder, 0, flags, &format);
+	auto layerLayout = getArrayLayerLayout(dib, format, flags);
+
+	vector<uint8_t> firstLayer;
+	auto uploadFormat = layerLayout.format;
+	if (flags & TextureImportFlags::COMPRESS) {
+		firstLayer.resize(size_t(layerLayout.getSize()));
+		writeMipChain(layerLayout, dib, firstLayer.data());
+		dib = nullptr;
+		uploadFormat = getImportFormat(layerLayout, firstLayer.data(), flags, true);
+	}
 
-	auto texture = make_unique<Texture3D>(VK_FORMAT_R32G32B32A32_SFLOAT, size, size, size, 1);
-	stagingBuffer->unmap();
-	texture->uploadFromStagingBuffer(stagingBuffer, 0);
+	auto textureLayout = layerLayout;
+	textureLayout.format = uploadFormat;
+	textureLayout.arrayLayers = arrayLayers;
+	unique_ptr<Texture2DArray> texture(createTexture2DArray(textureLayout));
+	textureLayout.arrayLayers = 1;
+
+	UploadBatch localBatch;
+	auto &batch = uploadBatch ? *uploadBatch : localBatch;
+	std::mutex batchMutex;
+
+	// write fills the layer's staging, laid out as textureLayout
+	auto uploadLayer = [&](int arrayLayer, const function<void(uint8_t *)> &write) {
+		StagingRegion staging;
+		{
+			std::lock_guard<std::mutex> lock(batchMutex);
+			staging = batch.allocateStaging(textureLayout.getSize(), vulkan::getFormatSize(textureLayout.format));
+		}
+
+		try {
+			write(static_cast<uint8_t *>(staging.data));
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(batchMutex);
+			batch.releaseStaging(staging);
+			throw;
+		}
+
+		std::lock_guard<std::mutex> lock(batchMutex);
+		batch.copyLayer(staging, texture.get(), arrayLayer);
+	};
+
+	// compression reads the mip chain back, so that goes through cached memory
+	auto writeLayer = [&](int arrayLayer, FIBITMAP *dib) {
+		if (!(flags & TextureImportFlags::COMPRESS)) {
+			uploadLayer(arrayLayer, [&](uint8_t *dst) {
+				writeMipChain(layerLayout, dib, dst);
+			});
+			return;
+		}
+
+		vector<uint8_t> data(size_t(layerLayout.getSize()));
+		writeMipChain(layerLayout, dib, data.data());
+		uploadLayer(arrayLayer, [&](uint8_t *dst) {
+			compressMipChain(layerLayout, data.data(), uploadFormat, flags, dst);
+		});
+	};
+
+	// enough layers in flight to keep the staging ring busy, but not to spill from it
+	auto maxInFlight = int(UploadBatch::getStagingCapacity() / textureLayout.getSize());
+
+	try {
+		if (dib)
+			writeLayer(0, dib);
+		else {
+			uploadLayer(0, [&](uint8_t *dst) {
+				compressMipChain(layerLayout, firstLayer.data(), uploadFormat, flags, dst);
+			});
+			vector<uint8_t>().swap(firstLayer);
+		}
+
+		decodeArrayLayers(folder, flags, layerLayout, arrayLayers, maxInFlight, writeLayer);
+	} catch (...) {
+		// the copies recorded so far write to the texture, so let them finish before it goes away
+		batch.submit().wait();
+		throw;
+	}
+
+	localBatch.submit();
 	return texture;
 }
+
+unique_ptr<Flipbook> importFlipbook(const string &folder, TextureImportFlags flags, int windowSize)
+{
+	auto frameCount = countArrayLayers(folder);
+
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	auto dib = loadArrayLayer(folder, 0, flags, &format);
+	auto frameLayout = getArrayLayerLayout(dib, format, flags);
+	FreeImage_Unload(dib);
+
+	return make_unique<Flipbook>(frameLayout, frameCount, windowSize, [folder, flags, frameLayout](int frame, void *dst) {
+		VkFormat format = VK_FORMAT_UNDEFINED;
+		auto dib = loadArrayLayer(folder, frame, flags, &format);
+		checkArrayLayer(frameLayout, dib, format);
+		writeMipChain(frameLayout, dib, dst);
+	});
+}
+
+unique_ptr<TextureCube> importTextureCube(const string &filename, TextureImportFlags flags)
+{
+	flags = getDeviceImportFlags(flags);
+	return importTextureCached(filename, flags, VK_IMAGE_VIEW_TYPE_CUBE, compressTexture([&](const TextureAllocator &allocate) {
+		loadTextureCube(filename, getLoadFlags(flags), allocate);
+	}, flags, true), createTextureCube);
+}
+
+unique_ptr<Texture3D> importCubeFile(const string &filename, const vector<VkFormat> &formats)
+{
+	// R16G16B16A16_SFLOAT must support filtering, so there's always a fallback
+	auto candidates = formats;
+	candidates.push_back(VK_FORMAT_R16G16B16A16_SFLOAT);
+	auto format = vulkan::findBestFormat(candidates, VK_IMAGE_TILING_OPTIMAL,
+		VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT);
+
+	return importTextureCached(filename, TextureImportFlags::NONE, VK_IMAGE_VIEW_TYPE_3D, [&](const TextureAllocator &allocate) {
+		loadCubeFile(filename, format, allocate);
+	}, createTexture3D, format);
+}
+
+unique_ptr<Texture2D> importTexture2D(const AssetPack &pack, const string &name)
+{
+	return importTexture(pack, name, VK_IMAGE_VIEW_TYPE_2D, createTexture2D);
+}
+
+unique_ptr<Texture2DArray> importTexture2DArray(const AssetPack &pack, const string &name)
+{
+	return importTexture(pack, name, VK_IMAGE_VIEW_TYPE_2D_ARRAY, createTexture2DArray);
+}
+
+unique_ptr<TextureCube> importTextureCube(const AssetPack &pack, const string &name)
+{
+	return importTexture(pack, name, VK_IMAGE_VIEW_TYPE_CUBE, createTextureCube);
+}
+
+unique_ptr<Texture3D> importTexture3D(const AssetPack &pack, const string &name)
+{
+	return importTexture(pack, name, VK_IMAGE_VIEW_TYPE_3D, createTexture3D);
+}
+
+void cookTexture2D(AssetPackWriter &writer, const string &name, const string &filename, TextureImportFlags flags)
+{
+	cookTexture(writer, name, VK_IMAGE_VIEW_TYPE_2D, compressTexture([&](const TextureAllocator &allocate) {
+		loadTexture2D(filename, flags, allocate);
+	}, flags, false));
+}
+
+void cookTexture2DArray(AssetPackWriter &writer, const string &name, const string &folder, TextureImportFlags flags)
+{
+	cookTexture(writer, name, VK_IMAGE_VIEW_TYPE_2D_ARRAY, compressTexture([&](const TextureAllocator &allocate) {
+		loadTexture2DArray(folder, flags, allocate);
+	}, flags, false));
+}
+
+void cookTextureCube(AssetPackWriter &writer, const string &name, const string &filename, TextureImportFlags flags)
+{
+	cookTexture(writer, name, VK_IMAGE_VIEW_TYPE_CUBE, compressTexture([&](const TextureAllocator &allocate) {
+		loadTextureCube(filename, flags, allocate);
+	}, flags, false));
+}
+
+void cookCubeFile(AssetPackWriter &writer, const string &name, const string &filename, VkFormat format)
+{
+	cookTexture(writer, name, VK_IMAGE_VIEW_TYPE_3D, [&](const TextureAllocator &allocate) {
+		loadCubeFile(filename, format, allocate);
+	});
+}
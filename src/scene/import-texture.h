@@ -2,13 +2,21 @@
 #define IMPORT_TEXTURE_H
 
 #include "texture.h"
+#include "flipbook.h"
 #include <string>
 #include <memory>
+#include <vector>
 
 enum TextureImportFlags {
 	NONE = 0,
 	GENERATE_MIPMAPS = 1 << 0,
 	PREMULTIPLY_ALPHA = 1 << 1,
+	SRGB = 1 << 2, // 8-bit images are sRGB-encoded, mipmaps are filtered in linear space
+	GPU_MIPMAPS = 1 << 3, // with GENERATE_MIPMAPS, upload mip 0 only and blit the rest on the GPU, if it can blit the format
+	COMPRESS = 1 << 4, // block-compress: BC1, or BC3 with alpha, and BC6H for HDR. Uncompressed without device support
+	COMPRESS_HIGH_QUALITY = 1 << 5, // with COMPRESS, slower encoding, and BC7 for 8-bit images
+	NORMAL_MAP = 1 << 6, // with COMPRESS, store red and green as BC5
+	SINGLE_CHANNEL = 1 << 7, // with COMPRESS, store red as BC4
 };
 
 inline TextureImportFlags operator|(const TextureImportFlags &a, const TextureImportFlags &b)
@@ -23,7 +31,45 @@ inline TextureImportFlags operator |= (TextureImportFlags &a, const TextureImpor
 
 std::unique_ptr<Texture2D> importTexture2D(const std::string &filename, TextureImportFlags flags);
 std::unique_ptr<TextureCube> importTextureCube(const std::string &filename, TextureImportFlags flags);
-std::unique_ptr<Texture2DArray> importTexture2DArray(const std::string &filename, TextureImportFlags flags);
-std::unique_ptr<Texture3D> importCubeFile(const std::string &filename);
+
+// Import the %04d.png sequence in folder, streaming each layer to the GPU as
+// it's decoded. This ignores GPU_MIPMAPS, and with COMPRESS, the first layer
+// decides whether the array has alpha.
+std::unique_ptr<Texture2DArray> importTexture2DArray(const std::string &folder, TextureImportFlags flags);
+
+// Import a .CUBE color LUT as the first of formats the device can filter,
+// or R16G16B16A16_SFLOAT. A2B10G10R10_UNORM_PACK32 clamps to [0, 1], and
+// B10G11R11_UFLOAT_PACK32 drops negative values.
+std::unique_ptr<Texture3D> importCubeFile(const std::string &filename, const std::vector<VkFormat> &formats = {});
+
+// Stream the same %04d.png sequence as importTexture2DArray, windowSize frames
+// at a time. Supports GENERATE_MIPMAPS, PREMULTIPLY_ALPHA and SRGB.
+std::unique_ptr<Flipbook> importFlipbook(const std::string &folder, TextureImportFlags flags, int windowSize = 16);
+
+// importTexture2D, importTextureCube and importCubeFile cache decoded results
+// here, keyed on file contents and flags. An empty path disables the cache.
+void setTextureCacheDirectory(const std::string &path);
+
+class UploadBatch;
+
+// While set, imports record their uploads into batch, which the caller must
+// submit before using the textures. Otherwise each import submits on its own.
+void setTextureUploadBatch(UploadBatch *batch);
+
+class AssetPack;
+class AssetPackWriter;
+
+// Import cooked textures from an asset pack. These just copy into staging memory.
+std::unique_ptr<Texture2D> importTexture2D(const AssetPack &pack, const std::string &name);
+std::unique_ptr<TextureCube> importTextureCube(const AssetPack &pack, const std::string &name);
+std::unique_ptr<Texture2DArray> importTexture2DArray(const AssetPack &pack, const std::string &name);
+std::unique_ptr<Texture3D> importTexture3D(const AssetPack &pack, const std::string &name);
+
+// Decode source images, and add the upload-ready result to an asset pack.
+// These compress regardless of what the current device supports.
+void cookTexture2D(AssetPackWriter &writer, const std::string &name, const std::string &filename, TextureImportFlags flags);
+void cookTextureCube(AssetPackWriter &writer, const std::string &name, const std::string &filename, TextureImportFlags flags);
+void cookTexture2DArray(AssetPackWriter &writer, const std::string &name, const std::string &folder, TextureImportFlags flags);
+void cookCubeFile(AssetPackWriter &writer, const std::string &name, const std::string &filename, VkFormat format = VK_FORMAT_R16G16B16A16_SFLOAT);
 
 #endif // IMPORT_TEXTURE_H
@@ -2,6 +2,9 @@
 #define RENDERTARGET_H
 
 #include "../vkinstance.h"
+#include "device-memory.h"
+
+#define RENDER_TARGET_DEDICATED_SIZE (4 * 1024 * 1024)
 
 class RenderTargetBase {
 protected:
@@ -26,16 +29,17 @@ protected:
 		imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 		imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 
-		VkResult err = vkCreateImage(device, &imageCreateInfo, nullptr, &image);
+		VkResult err = vkCreateImage(vulkan::device, &imageCreateInfo, nullptr, &image);
 		assert(err == VK_SUCCESS);
 
 		VkMemoryRequirements memoryRequirements;
-		vkGetImageMemoryRequirements(device, image, &memoryRequirements);
+		vkGetImageMemoryRequirements(vulkan::device, image, &memoryRequirements);
 
-		auto memoryTypeIndex = getMemoryTypeIndex(memoryRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-		auto deviceMemory = allocateDeviceMemory(memoryRequirements.size, memoryTypeIndex);
+		// big targets get memory of their own, which drivers may place better
+		auto dedicated = memoryRequirements.size >= RENDER_TARGET_DEDICATED_SIZE;
+		memory = allocateMemory(memoryRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true, dedicated);
 
-		err = vkBindImageMemory(device, image, deviceMemory, 0);
+		err = vkBindImageMemory(vulkan::device, image, memory.memory, memory.offset);
 		assert(err == VK_SUCCESS);
 
 		VkImageSubresourceRange subresourceRange;
@@ -45,10 +49,20 @@ protected:
 		subresourceRange.levelCount = 1;
 		subresourceRange.layerCount = arrayLayers;
 
-		imageView = createImageView(image, imageViewType, format, subresourceRange);
+		imageView = vulkan::createImageView(image, imageViewType, format, subresourceRange);
 	}
 
 public:
+	~RenderTargetBase()
+	{
+		vkDestroyImageView(vulkan::device, imageView, nullptr);
+		vkDestroyImage(vulkan::device, image, nullptr);
+		freeMemory(memory);
+	}
+
+	RenderTargetBase(const RenderTargetBase &) = delete;
+	RenderTargetBase &operator=(const RenderTargetBase &) = delete;
+
 	VkFormat getFormat() { return format; }
 
 	int getWidth() const { return width; }
@@ -68,6 +82,7 @@ protected:
 
 	VkImage image;
 	VkImageView imageView;
+	DeviceMemoryAllocation memory;
 };
 
 class ColorRenderTarget : public RenderTargetBase {
@@ -78,6 +93,15 @@ public:
 	}
 };
 
+// A single-sampled 3D image, e.g. for a LUT written by a compute shader
+class VolumeRenderTarget : public RenderTargetBase {
+public:
+	VolumeRenderTarget(VkFormat format, int width, int height, int depth, VkImageUsageFlags usage) :
+		RenderTargetBase(format, VK_IMAGE_TYPE_3D, VK_IMAGE_VIEW_TYPE_3D, width, height, depth, 1, VK_SAMPLE_COUNT_1_BIT, usage, VK_IMAGE_ASPECT_COLOR_BIT)
+	{
+	}
+};
+
 class DepthRenderTarget : public RenderTargetBase {
 public:
 	DepthRenderTarget(VkFormat format, int width, int height, VkSampleCountFlagBits sampleCount, VkImageUsageFlags usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT) :
@@ -161,7 +161,7 @@ private:
 
 class Scene {
 public:
-	Scene()
+	Scene() : structureVersion(0)
 	{
 		transforms.push_back(&rootTransform);
 	}
@@ -175,6 +175,7 @@ public:
 
 		trans->setParent(parent);
 		transforms.push_back(trans);
+		++structureVersion;
 		return trans;
 	}
 
@@ -182,6 +183,7 @@ public:
 	{
 		assert(!transform || transform->getRootTransform() == &rootTransform);
 		objects.emplace_back(model, transform ? *transform : rootTransform);
+		++structureVersion;
 		return objects.back();
 	}
 
@@ -190,10 +192,14 @@ public:
 	const std::list<Object> &getObjects() const { return objects; }
 	const std::list<Transform *> &getTransforms() const { return transforms; }
 
+	// changes whenever objects or transforms are added, but not when they animate
+	uint64_t getStructureVersion() const { return structureVersion; }
+
 private:
 	std::list<Transform *> transforms;
 	std::list<Object> objects;
 	RootTransform rootTransform;
+	uint64_t structureVersion;
 };
 
 
@@ -0,0 +1,54 @@
+#include "staging-ring.h"
+
+#include <algorithm>
+
+StagingRing::StagingRing(VkDeviceSize size) :
+	buffer(size),
+	size(size),
+	head(0)
+{
+	mappedMemory = static_cast<uint8_t *>(buffer.map(0, size));
+}
+
+StagingRing::~StagingRing()
+{
+	assert(ranges.empty());
+	buffer.unmap();
+}
+
+bool StagingRing::allocate(VkDeviceSize allocationSize, VkDeviceSize alignment, uint64_t *position)
+{
+	assert(allocationSize > 0);
+	assert(alignment > 0 && size % alignment == 0);
+	assert(position != nullptr);
+
+	if (allocationSize > size)
+		return false;
+
+	auto tail = ranges.empty() ? head : ranges.front().position;
+
+	// ranges don't wrap; skip to the start of the buffer instead
+	auto begin = vulkan::alignSize(head, alignment);
+	if (begin % size + allocationSize > size)
+		begin = vulkan::alignSize(begin, size);
+
+	if (begin + allocationSize - tail > size)
+		return false;
+
+	head = begin + allocationSize;
+	ranges.push_back({ begin, false });
+	*position = begin;
+	return true;
+}
+
+void StagingRing::release(uint64_t position)
+{
+	auto it = std::lower_bound(ranges.begin(), ranges.end(), position, [](const Range &range, uint64_t position) {
+		return range.position < position;
+	});
+	assert(it != ranges.end() && it->position == position && !it->released);
+	it->released = true;
+
+	while (!ranges.empty() && ranges.front().released)
+		ranges.pop_front();
+}
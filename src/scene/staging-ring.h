@@ -0,0 +1,51 @@
+#ifndef STAGING_RING_H
+#define STAGING_RING_H
+
+#include "buffer.h"
+
+#include <deque>
+
+/*
+ * A fixed-size, persistently mapped staging buffer, handed out as aligned
+ * sub-ranges in FIFO order. Ranges are released out of order, but space is
+ * only reused once everything allocated before it has been released too.
+ *
+ * The ring knows nothing about the GPU; whoever submits copies from a range
+ * releases it once the submit's fence has signaled.
+ */
+class StagingRing {
+public:
+	explicit StagingRing(VkDeviceSize size);
+	~StagingRing();
+
+	StagingRing(const StagingRing &) = delete;
+	StagingRing &operator=(const StagingRing &) = delete;
+
+	// Returns false if there's no room until something is released. On
+	// success, *position identifies the range for release().
+	bool allocate(VkDeviceSize size, VkDeviceSize alignment, uint64_t *position);
+	void release(uint64_t position);
+
+	VkDeviceSize getOffset(uint64_t position) const { return VkDeviceSize(position % size); }
+	void *getData(uint64_t position) const { return mappedMemory + getOffset(position); }
+
+	const StagingBuffer &getBuffer() const { return buffer; }
+	VkDeviceSize getSize() const { return size; }
+	bool empty() const { return ranges.empty(); }
+
+private:
+	struct Range {
+		uint64_t position;
+		bool released;
+	};
+
+	StagingBuffer buffer;
+	VkDeviceSize size;
+	uint8_t *mappedMemory;
+
+	// positions grow forever, and wrap around the buffer modulo size
+	uint64_t head;
+	std::deque<Range> ranges;
+};
+
+#endif // STAGING_RING_H
@@ -3,6 +3,7 @@
 using namespace vulkan;
 
 TextureBase::TextureBase(VkFormat format, VkImageType imageType, VkImageViewType imageViewType, int width, int height, int depth, int mipLevels, int arrayLayers, bool useStaging) :
+	format(format),
 	baseWidth(width),
 	baseHeight(height),
 	baseDepth(depth),
@@ -34,8 +35,8 @@ TextureBase::TextureBase(VkFormat format, VkImageType imageType, VkImageViewType
 	imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 	imageCreateInfo.initialLayout = useStaging ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_PREINITIALIZED;
 
-	if (useStaging)
-		imageCreateInfo.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	if (useStaging) // TRANSFER_SRC is for generating mipmaps
+		imageCreateInfo.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
 
 	VkResult err = vkCreateImage(device, &imageCreateInfo, nullptr, &image);
 	assert(err == VK_SUCCESS);
@@ -43,10 +44,9 @@ TextureBase::TextureBase(VkFormat format, VkImageType imageType, VkImageViewType
 	VkMemoryRequirements memoryRequirements;
 	vkGetImageMemoryRequirements(device, image, &memoryRequirements);
 
-	auto memoryTypeIndex = getMemoryTypeIndex(memoryRequirements, useStaging ? VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT : VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-	deviceMemory = allocateDeviceMemory(memoryRequirements.size, memoryTypeIndex);
+	memory = allocateMemory(memoryRequirements, useStaging ? VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT : VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, useStaging);
 
-	err = vkBindImageMemory(device, image, deviceMemory, 0);
+	err = vkBindImageMemory(device, image, memory.memory, memory.offset);
 	assert(err == VK_SUCCESS);
 
 	VkImageSubresourceRange subresourceRange;
@@ -59,61 +59,76 @@ TextureBase::TextureBase(VkFormat format, VkImageType imageType, VkImageViewType
 	imageView = createImageView(image, imageViewType, format, subresourceRange);
 }
 
-void TextureBase::uploadFromStagingBuffer(StagingBuffer *stagingBuffer, int mipLevel, int arrayLayer)
+TextureBase::~TextureBase()
 {
-	assert(stagingBuffer != nullptr);
-
-	auto commandBuffer = getSetupCommandBuffer();
+	vkDestroyImageView(device, imageView, nullptr);
+	vkDestroyImage(device, image, nullptr);
+	freeMemory(memory);
+}
 
-	VkCommandBufferBeginInfo commandBufferBeginInfo = {};
-	commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+bool TextureBase::canGenerateMipmaps(VkFormat format)
+{
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &formatProperties);
 
-	VkResult err = vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo);
-	assert(err == VK_SUCCESS);
+	const VkFormatFeatureFlags requiredFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+	return (formatProperties.optimalTilingFeatures & requiredFeatures) == requiredFeatures;
+}
 
-	VkImageSubresourceRange subresourceRange = {
+void TextureBase::generateMipmaps(VkCommandBuffer commandBuffer)
+{
+	// checked before recording, as this runs halfway through a submit
+	assert(canGenerateMipmaps(format));
+
+	for (auto mipLevel = 1; mipLevel < mipLevels; ++mipLevel) {
+		VkImageSubresourceRange srcRange = {
+			VK_IMAGE_ASPECT_COLOR_BIT,
+			uint32_t(mipLevel - 1), 1,
+			0, uint32_t(arrayLayers)
+		};
+
+		imageBarrier(commandBuffer,
+			image, srcRange,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+
+		VkImageBlit imageBlit = {};
+		imageBlit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, uint32_t(mipLevel - 1), 0, uint32_t(arrayLayers) };
+		imageBlit.srcOffsets[1] = { mipSize(baseWidth, mipLevel - 1), mipSize(baseHeight, mipLevel - 1), mipSize(baseDepth, mipLevel - 1) };
+		imageBlit.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, uint32_t(mipLevel), 0, uint32_t(arrayLayers) };
+		imageBlit.dstOffsets[1] = { mipSize(baseWidth, mipLevel), mipSize(baseHeight, mipLevel), mipSize(baseDepth, mipLevel) };
+
+		vkCmdBlitImage(commandBuffer,
+			image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			1, &imageBlit, VK_FILTER_LINEAR);
+	}
+
+	// all but the last level were blit sources
+	if (mipLevels > 1) {
+		VkImageSubresourceRange srcLevels = {
+			VK_IMAGE_ASPECT_COLOR_BIT,
+			0, uint32_t(mipLevels - 1),
+			0, uint32_t(arrayLayers)
+		};
+
+		imageBarrier(commandBuffer,
+			image, srcLevels,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT,
+			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	}
+
+	VkImageSubresourceRange lastLevel = {
 		VK_IMAGE_ASPECT_COLOR_BIT,
-		uint32_t(mipLevel), 1,
-		uint32_t(arrayLayer), 1
+		uint32_t(mipLevels - 1), 1,
+		0, uint32_t(arrayLayers)
 	};
 
 	imageBarrier(commandBuffer,
-		image, subresourceRange,
-		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
-		0, VK_ACCESS_TRANSFER_WRITE_BIT,
-		VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-	VkBufferImageCopy copyRegion = {};
-	copyRegion.bufferOffset = 0;
-	copyRegion.bufferRowLength = 0;
-	copyRegion.bufferImageHeight = 0;
-	copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	copyRegion.imageSubresource.baseArrayLayer = arrayLayer;
-	copyRegion.imageSubresource.mipLevel = mipLevel;
-	copyRegion.imageSubresource.layerCount = 1;
-	copyRegion.imageOffset = { 0, 0, 0 };
-	copyRegion.imageExtent.width = mipSize(baseWidth, mipLevel);
-	copyRegion.imageExtent.height = mipSize(baseHeight, mipLevel);
-	copyRegion.imageExtent.depth = mipSize(baseDepth, mipLevel);
-
-	vkCmdCopyBufferToImage(commandBuffer, stagingBuffer->getBuffer(), image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
-
-	imageBarrier(commandBuffer,
-		image, subresourceRange,
-		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
-		0, VK_ACCESS_TRANSFER_WRITE_BIT,
+		image, lastLevel,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
 		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-
-	err = vkEndCommandBuffer(commandBuffer);
-	assert(err == VK_SUCCESS);
-
-	VkSubmitInfo submitInfo = {};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
-
-	// Submit draw command buffer
-	err = vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-	assert(err == VK_SUCCESS);
 }
@@ -3,13 +3,27 @@
 
 #include <algorithm>
 #include "buffer.h"
+#include "device-memory.h"
 #include "../core/core.h"
 
+// Upload-ready layout of a whole texture in a buffer: all array layers of
+// mip 0, then all array layers of mip 1, and so on, tightly packed.
+struct TextureLayout {
+	VkFormat format;
+	int width, height, depth;
+	int mipLevels, arrayLayers;
+
+	VkDeviceSize getLevelSize(int mipLevel) const;
+	VkDeviceSize getSubresourceOffset(int mipLevel, int arrayLayer = 0) const;
+	VkDeviceSize getSize() const { return getSubresourceOffset(mipLevels); }
+};
+
 class TextureBase {
 protected:
 	TextureBase(VkFormat format, VkImageType imageType, VkImageViewType imageViewType, int width, int height, int depth, int mipLevels = 1, int arrayLayers = 1, bool useStaging = true);
 
 public:
+	~TextureBase();
 
 	static int mipSize(int size, int mipLevel)
 	{
@@ -29,7 +43,22 @@ public:
 	int getMipLevels() const { return mipLevels; }
 	int getArrayLayers() const { return arrayLayers; }
 
-	void uploadFromStagingBuffer(StagingBuffer *stagingBuffer, int mipLevel = 0, int arrayLayer = 0);
+	VkFormat getFormat() const { return format; }
+
+	TextureLayout getLayout() const
+	{
+		return { format, baseWidth, baseHeight, baseDepth, mipLevels, arrayLayers };
+	}
+
+	// Whether generateMipmaps() can blit images of format
+	static bool canGenerateMipmaps(VkFormat format);
+
+	// Expects every level in TRANSFER_DST_OPTIMAL with mip 0 written, and
+	// leaves every level in SHADER_READ_ONLY_OPTIMAL. The format must pass
+	// canGenerateMipmaps().
+	void generateMipmaps(VkCommandBuffer commandBuffer);
+
+	VkImage getImage() const { return image; }
 
 	VkImageView getImageView()
 	{
@@ -59,26 +88,49 @@ public:
 
 	void *map(VkDeviceSize offset, VkDeviceSize size)
 	{
-		void *ret;
-		VkResult err = vkMapMemory(vulkan::device, deviceMemory, offset, size, 0, &ret);
-		assert(err == VK_SUCCESS);
-		return ret;
+		assert(memory.mappedData != nullptr);
+		assert(offset + size <= memory.size);
+		return memory.mappedData + offset;
 	}
 
 	void unmap()
 	{
-		vkUnmapMemory(vulkan::device, deviceMemory);
+		flushMemory(memory);
 	}
 
 protected:
+	VkFormat format;
 	int baseWidth, baseHeight, baseDepth;
 	int mipLevels, arrayLayers;
 
 	VkImage image;
 	VkImageView imageView;
-	VkDeviceMemory deviceMemory;
+	DeviceMemoryAllocation memory;
 };
 
+inline VkDeviceSize TextureLayout::getLevelSize(int mipLevel) const
+{
+	// block-compressed levels are padded up to whole blocks
+	auto blockExtent = vulkan::getFormatBlockExtent(format);
+	auto blocksWide = (TextureBase::mipSize(width, mipLevel) + blockExtent - 1) / blockExtent;
+	auto blocksHigh = (TextureBase::mipSize(height, mipLevel) + blockExtent - 1) / blockExtent;
+	return VkDeviceSize(blocksWide) * blocksHigh *
+	       TextureBase::mipSize(depth, mipLevel) *
+	       vulkan::getFormatSize(format);
+}
+
+inline VkDeviceSize TextureLayout::getSubresourceOffset(int mipLevel, int arrayLayer) const
+{
+	assert(mipLevel >= 0 && mipLevel <= mipLevels);
+	assert(arrayLayer >= 0 && arrayLayer < arrayLayers);
+
+	VkDeviceSize offset = 0;
+	for (auto i = 0; i < mipLevel; ++i)
+		offset += getLevelSize(i) * arrayLayers;
+
+	return offset + getLevelSize(mipLevel) * arrayLayer;
+}
+
 class Texture2D : public TextureBase {
 public:
 	Texture2D(VkFormat format, int width, int height, int mipLevels = 1, int arrayLayers = 1, bool useStaging = true) :
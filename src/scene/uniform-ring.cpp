@@ -0,0 +1,58 @@
+#include "uniform-ring.h"
+
+using namespace vulkan;
+
+// every buffer has a host-visible, coherent memory type to pick, so endFrame() has nothing to flush
+UniformRing::UniformRing(VkDeviceSize frameSize, int frameCount) :
+	buffer(alignSize(frameSize, deviceProperties.limits.minUniformBufferOffsetAlignment) * frameCount,
+	       VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+	       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT),
+	frameSize(alignSize(frameSize, deviceProperties.limits.minUniformBufferOffsetAlignment)),
+	alignment(deviceProperties.limits.minUniformBufferOffsetAlignment),
+	frameCount(frameCount),
+	frameIndex(-1),
+	head(0)
+{
+	assert(frameSize > 0);
+	assert(frameCount > 0);
+
+	// dynamic offsets are 32-bit
+	if (buffer.getSize() > UINT32_MAX)
+		throw std::runtime_error("uniform ring too large!");
+
+	mappedMemory = static_cast<uint8_t *>(buffer.map(0, buffer.getSize()));
+}
+
+void UniformRing::beginFrame(int frameIndex)
+{
+	assert(this->frameIndex < 0);
+	assert(frameIndex >= 0 && frameIndex < frameCount);
+
+	this->frameIndex = frameIndex;
+	head = 0;
+}
+
+void *UniformRing::allocate(VkDeviceSize size, uint32_t *dynamicOffset)
+{
+	assert(frameIndex >= 0);
+	assert(dynamicOffset != nullptr);
+
+	auto begin = alignSize(head, alignment);
+	if (begin + size > frameSize)
+		throw std::runtime_error("out of uniform space!");
+	head = begin + size;
+
+	auto offset = frameSize * frameIndex + begin;
+	*dynamicOffset = uint32_t(offset);
+	return mappedMemory + offset;
+}
+
+void UniformRing::endFrame()
+{
+	assert(frameIndex >= 0);
+
+	if (head > 0)
+		buffer.flush(frameSize * frameIndex, head);
+
+	frameIndex = -1;
+}
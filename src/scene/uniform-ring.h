@@ -0,0 +1,57 @@
+#ifndef UNIFORM_RING_H
+#define UNIFORM_RING_H
+
+#include "buffer.h"
+
+/*
+ * A persistently mapped uniform buffer with one region per frame in
+ * flight. Each frame writes its uniforms into its own region and binds
+ * them through dynamic offsets, so the CPU never overwrites uniforms a
+ * frame still on the GPU reads.
+ *
+ * The ring knows nothing about the GPU; call beginFrame() only once the
+ * fence of the frame that last used the region has signaled.
+ */
+class UniformRing {
+public:
+	UniformRing(VkDeviceSize frameSize, int frameCount);
+
+	UniformRing(const UniformRing &) = delete;
+	UniformRing &operator=(const UniformRing &) = delete;
+
+	void beginFrame(int frameIndex);
+
+	// Returns where to write size bytes, and the dynamic offset to bind them at
+	void *allocate(VkDeviceSize size, uint32_t *dynamicOffset);
+
+	template <typename T>
+	uint32_t push(const T &data)
+	{
+		uint32_t dynamicOffset;
+		memcpy(allocate(sizeof(data), &dynamicOffset), &data, sizeof(data));
+		return dynamicOffset;
+	}
+
+	// makes this frame's writes visible to the device
+	void endFrame();
+
+	// for UNIFORM_BUFFER_DYNAMIC descriptors, where range is the size of one binding
+	VkDescriptorBufferInfo getDescriptorBufferInfo(VkDeviceSize range)
+	{
+		return buffer.getDescriptorBufferInfo(0, range);
+	}
+
+	VkDeviceSize getFrameSize() const { return frameSize; }
+	int getFrameCount() const { return frameCount; }
+
+private:
+	Buffer buffer;
+	VkDeviceSize frameSize, alignment;
+	int frameCount;
+	uint8_t *mappedMemory;
+
+	int frameIndex;
+	VkDeviceSize head;
+};
+
+#endif // UNIFORM_RING_H
@@ -0,0 +1,606 @@
+#include "upload-batch.h"
+#include "staging-ring.h"
+#include "texture.h"
+
+#include <list>
+
+using namespace vulkan;
+
+using std::list;
+using std::shared_ptr;
+using std::unique_ptr;
+using std::vector;
+
+// Bounds the host-visible memory used for loading, apart from spills
+#define STAGING_RING_SIZE (32 << 20)
+
+// Without a transfer-only queue family, only the graphics command buffer is used
+struct UploadSubmission {
+	VkFence fence;
+	VkCommandBuffer graphicsCommandBuffer;
+	VkCommandBuffer transferCommandBuffer;
+	VkSemaphore semaphore;
+	vector<uint64_t> ringPositions;
+	vector<unique_ptr<StagingBuffer>> spills;
+};
+
+static list<shared_ptr<UploadSubmission>> inFlight;
+static unique_ptr<StagingRing> stagingRing;
+
+// Our own pools, so uploads keep working after setupCleanup()
+static VkCommandPool graphicsCommandPool = VK_NULL_HANDLE;
+static VkCommandPool transferCommandPool = VK_NULL_HANDLE;
+
+static StagingRing &getStagingRing()
+{
+	if (!stagingRing)
+		stagingRing.reset(new StagingRing(STAGING_RING_SIZE));
+	return *stagingRing;
+}
+
+static bool useTransferQueue()
+{
+	return transferQueueFamily != graphicsQueueFamily;
+}
+
+static VkCommandBuffer beginCommandBuffer(VkCommandPool *commandPool, uint32_t queueFamily)
+{
+	if (*commandPool == VK_NULL_HANDLE)
+		*commandPool = createCommandPool(queueFamily);
+
+	auto commandBuffer = allocateCommandBuffers(*commandPool, 1)[0];
+
+	VkCommandBufferBeginInfo commandBufferBeginInfo = {};
+	commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	VkResult err = vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo);
+	assert(err == VK_SUCCESS);
+
+	return commandBuffer;
+}
+
+static void release(UploadSubmission &submission)
+{
+	vkDestroyFence(device, submission.fence, nullptr);
+	vkFreeCommandBuffers(device, graphicsCommandPool, 1, &submission.graphicsCommandBuffer);
+	if (submission.transferCommandBuffer != VK_NULL_HANDLE) {
+		vkFreeCommandBuffers(device, transferCommandPool, 1, &submission.transferCommandBuffer);
+		vkDestroySemaphore(device, submission.semaphore, nullptr);
+	}
+
+	submission.fence = VK_NULL_HANDLE;
+	submission.graphicsCommandBuffer = VK_NULL_HANDLE;
+	submission.transferCommandBuffer = VK_NULL_HANDLE;
+	submission.semaphore = VK_NULL_HANDLE;
+
+	for (auto position : submission.ringPositions)
+		stagingRing->release(position);
+	submission.ringPositions.clear();
+	submission.spills.clear();
+}
+
+// release whatever has completed, without blocking
+static void collectUploads()
+{
+	for (auto it = inFlight.begin(); it != inFlight.end(); ) {
+		if (vkGetFenceStatus(device, (*it)->fence) == VK_SUCCESS) {
+			release(**it);
+			it = inFlight.erase(it);
+		} else
+			++it;
+	}
+}
+
+static void waitForOldestUpload()
+{
+	assert(!inFlight.empty());
+	auto &submission = inFlight.front();
+	VkResult err = vkWaitForFences(device, 1, &submission->fence, VK_TRUE, UINT64_MAX);
+	assert(err == VK_SUCCESS);
+	release(*submission);
+	inFlight.pop_front();
+}
+
+void finishUploads()
+{
+	while (!inFlight.empty())
+		waitForOldestUpload();
+
+	// unless a batch still holds on to some of it
+	if (stagingRing && stagingRing->empty())
+		stagingRing.reset();
+
+	if (graphicsCommandPool != VK_NULL_HANDLE)
+		vkDestroyCommandPool(device, graphicsCommandPool, nullptr);
+	if (transferCommandPool != VK_NULL_HANDLE)
+		vkDestroyCommandPool(device, transferCommandPool, nullptr);
+	graphicsCommandPool = transferCommandPool = VK_NULL_HANDLE;
+}
+
+bool UploadToken::isComplete() const
+{
+	return !submission || submission->fence == VK_NULL_HANDLE ||
+	       vkGetFenceStatus(device, submission->fence) == VK_SUCCESS;
+}
+
+void UploadToken::wait() const
+{
+	if (isComplete())
+		return;
+
+	VkResult err = vkWaitForFences(device, 1, &submission->fence, VK_TRUE, UINT64_MAX);
+	assert(err == VK_SUCCESS);
+}
+
+UploadBatch::~UploadBatch()
+{
+	assert(empty()); // forgot to submit?
+	releaseStaging();
+}
+
+// Nothing on the GPU reads allocations that no copy was recorded from
+void UploadBatch::releaseStaging()
+{
+	for (const auto &allocation : staging)
+		if (!allocation.spill)
+			stagingRing->release(allocation.ringPosition);
+	staging.clear();
+}
+
+VkDeviceSize UploadBatch::getStagingCapacity()
+{
+	return STAGING_RING_SIZE;
+}
+
+void UploadBatch::releaseStaging(const StagingRegion &region)
+{
+	for (auto it = staging.begin(); it != staging.end(); ++it) {
+		if (it->region.buffer == region.buffer && it->region.offset == region.offset) {
+			assert(!it->copied);
+			if (!it->spill)
+				stagingRing->release(it->ringPosition);
+			staging.erase(it);
+			return;
+		}
+	}
+
+	assert(!"staging region not allocated from this batch");
+}
+
+StagingRegion UploadBatch::allocateStaging(VkDeviceSize size, VkDeviceSize alignment)
+{
+	assert(size > 0);
+	assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+	// copies need 4-byte aligned offsets, and may be faster at the optimal alignment
+	alignment = std::max(alignment, std::max(VkDeviceSize(4), deviceProperties.limits.optimalBufferCopyOffsetAlignment));
+
+	StagingAllocation allocation = {};
+	auto &ring = getStagingRing();
+	auto allocated = false;
+	if (size <= ring.getSize()) {
+		while (!(allocated = ring.allocate(size, alignment, &allocation.ringPosition))) {
+			if (!empty())
+				submit(); // the copies recorded so far don't need to wait for the rest
+			else if (!inFlight.empty())
+				waitForOldestUpload();
+			else
+				break; // held by allocations no copy was recorded from yet
+		}
+	}
+
+	if (allocated) {
+		allocation.region.buffer = &ring.getBuffer();
+		allocation.region.offset = ring.getOffset(allocation.ringPosition);
+		allocation.region.data = ring.getData(allocation.ringPosition);
+	} else {
+		allocation.spill.reset(new StagingBuffer(size));
+		allocation.region.buffer = allocation.spill.get();
+		allocation.region.offset = 0;
+		allocation.region.data = allocation.spill->map(0, size);
+	}
+	allocation.region.size = size;
+
+	staging.push_back(std::move(allocation));
+	return staging.back().region;
+}
+
+void UploadBatch::markCopied(const StagingRegion &src)
+{
+	for (auto &allocation : staging) {
+		if (allocation.region.buffer == src.buffer && allocation.region.offset == src.offset) {
+			assert(src.size <= allocation.region.size);
+			allocation.copied = true;
+			return;
+		}
+	}
+
+	assert(!"staging region not allocated from this batch");
+}
+
+void UploadBatch::copyBuffer(const StagingRegion &src, Buffer *dst, VkDeviceSize dstOffset)
+{
+	assert(dst != nullptr);
+	assert(dstOffset + src.size <= dst->getSize());
+	markCopied(src);
+
+	BufferCopy copy;
+	copy.src = src.buffer;
+	copy.dst = dst;
+	copy.region.srcOffset = src.offset;
+	copy.region.dstOffset = dstOffset;
+	copy.region.size = src.size;
+	bufferCopies.push_back(copy);
+}
+
+void UploadBatch::copyMipChain(const StagingRegion &src, TextureBase *dst, bool generateMipmaps)
+{
+	assert(dst != nullptr);
+
+	auto layout = dst->getLayout();
+	if (generateMipmaps) {
+		assert(TextureBase::canGenerateMipmaps(layout.format));
+		layout.mipLevels = 1;
+	}
+	assert(layout.getSize() <= src.size);
+	assert(src.offset % getFormatSize(layout.format) == 0);
+	markCopied(src);
+
+	// the whole image starts out UNDEFINED, so each texture goes in once
+	for (const auto &copy : textureCopies)
+		assert(copy.dst != dst);
+
+	TextureCopy copy;
+	copy.src = src;
+	copy.dst = dst;
+	copy.generateMipmaps = generateMipmaps;
+	textureCopies.push_back(copy);
+}
+
+void UploadBatch::copyLayer(const StagingRegion &src, TextureBase *dst, int arrayLayer)
+{
+	assert(dst != nullptr);
+	assert(arrayLayer >= 0 && arrayLayer < dst->getArrayLayers());
+
+	auto layout = dst->getLayout();
+	layout.arrayLayers = 1;
+	assert(layout.getSize() <= src.size);
+	assert(src.offset % getFormatSize(layout.format) == 0);
+	markCopied(src);
+
+	LayerCopy copy;
+	copy.src = src;
+	copy.dst = dst;
+	copy.arrayLayer = arrayLayer;
+	layerCopies.push_back(copy);
+}
+
+void UploadBatch::transitionToShaderRead(TextureBase *dst)
+{
+	assert(dst != nullptr);
+	transitions.push_back(dst);
+}
+
+// Stages that may read uploaded data, and that acquiring it on the graphics queue waits for
+#define UPLOAD_READ_STAGES \
+	(VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | \
+	 VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT)
+
+#define BUFFER_READ_ACCESS \
+	(VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT)
+
+static VkImageMemoryBarrier textureBarrier(const TextureBase *texture,
+	VkAccessFlags srcAccess, VkAccessFlags dstAccess,
+	VkImageLayout oldLayout, VkImageLayout newLayout,
+	uint32_t srcQueueFamily = VK_QUEUE_FAMILY_IGNORED,
+	uint32_t dstQueueFamily = VK_QUEUE_FAMILY_IGNORED,
+	int arrayLayer = -1)
+{
+	VkImageMemoryBarrier imageBarrier = {};
+	imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	imageBarrier.srcAccessMask = srcAccess;
+	imageBarrier.dstAccessMask = dstAccess;
+	imageBarrier.oldLayout = oldLayout;
+	imageBarrier.newLayout = newLayout;
+	imageBarrier.srcQueueFamilyIndex = srcQueueFamily;
+	imageBarrier.dstQueueFamilyIndex = dstQueueFamily;
+	imageBarrier.image = texture->getImage();
+	imageBarrier.subresourceRange = {
+		VK_IMAGE_ASPECT_COLOR_BIT,
+		0, uint32_t(texture->getMipLevels()),
+		0, uint32_t(texture->getArrayLayers())
+	};
+
+	// or just one layer
+	if (arrayLayer >= 0) {
+		imageBarrier.subresourceRange.baseArrayLayer = uint32_t(arrayLayer);
+		imageBarrier.subresourceRange.layerCount = 1;
+	}
+
+	return imageBarrier;
+}
+
+// Everything into TRANSFER_DST in one barrier, then all the copies
+void UploadBatch::recordCopies(VkCommandBuffer commandBuffer)
+{
+	vector<VkImageMemoryBarrier> imageBarriers;
+	for (const auto &copy : textureCopies)
+		imageBarriers.push_back(textureBarrier(copy.dst,
+			0, VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL));
+
+	if (!imageBarriers.empty())
+		vkCmdPipelineBarrier(commandBuffer,
+			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+			0, nullptr,
+			0, nullptr,
+			uint32_t(imageBarriers.size()), imageBarriers.data());
+
+	for (const auto &copy : bufferCopies)
+		vkCmdCopyBuffer(commandBuffer, copy.src->getBuffer(), copy.dst->getBuffer(), 1, &copy.region);
+
+	for (const auto &copy : textureCopies) {
+		auto texture = copy.dst;
+		auto layout = texture->getLayout();
+		if (copy.generateMipmaps)
+			layout.mipLevels = 1;
+
+		// one region per mip-level, covering all array layers
+		vector<VkBufferImageCopy> copyRegions(layout.mipLevels);
+		for (auto mipLevel = 0; mipLevel < layout.mipLevels; ++mipLevel) {
+			auto &copyRegion = copyRegions[mipLevel];
+			copyRegion = {};
+			copyRegion.bufferOffset = copy.src.offset + layout.getSubresourceOffset(mipLevel);
+			copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			copyRegion.imageSubresource.mipLevel = mipLevel;
+			copyRegion.imageSubresource.baseArrayLayer = 0;
+			copyRegion.imageSubresource.layerCount = layout.arrayLayers;
+			copyRegion.imageExtent.width = texture->getWidth(mipLevel);
+			copyRegion.imageExtent.height = texture->getHeight(mipLevel);
+			copyRegion.imageExtent.depth = texture->getDepth(mipLevel);
+		}
+
+		vkCmdCopyBufferToImage(commandBuffer, copy.src.buffer->getBuffer(), texture->getImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, uint32_t(copyRegions.size()), copyRegions.data());
+	}
+}
+
+/*
+ * Make the copies visible to shaders, or to mipmap generation, in one
+ * barrier. On a single queue that's all there is to it. With a transfer
+ * queue, the same barrier is recorded twice to hand ownership over: the
+ * release after the copies on the transfer queue, and the acquire on the
+ * graphics queue after waiting for the transfer queue's semaphore.
+ */
+void UploadBatch::recordHandoff(VkCommandBuffer commandBuffer, HandoffStep step)
+{
+	auto srcQueueFamily = step != HANDOFF_SAME_QUEUE ? transferQueueFamily : VK_QUEUE_FAMILY_IGNORED;
+	auto dstQueueFamily = step != HANDOFF_SAME_QUEUE ? graphicsQueueFamily : VK_QUEUE_FAMILY_IGNORED;
+	VkAccessFlags srcAccess = step != HANDOFF_ACQUIRE ? VK_ACCESS_TRANSFER_WRITE_BIT : 0;
+
+	vector<VkImageMemoryBarrier> imageBarriers;
+	for (const auto &copy : textureCopies) {
+		// generateMipmaps() does its own transitions, but has to own the image first
+		if (copy.generateMipmaps && step == HANDOFF_SAME_QUEUE)
+			continue;
+
+		VkAccessFlags dstAccess = copy.generateMipmaps ? VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT : VK_ACCESS_SHADER_READ_BIT;
+		imageBarriers.push_back(textureBarrier(copy.dst,
+			srcAccess, step != HANDOFF_RELEASE ? dstAccess : 0,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			copy.generateMipmaps ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			srcQueueFamily, dstQueueFamily));
+	}
+
+	// buffers have no layout, so on one queue a memory barrier covers all of them
+	VkMemoryBarrier memoryBarrier = {};
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.srcAccessMask = srcAccess;
+	memoryBarrier.dstAccessMask = BUFFER_READ_ACCESS;
+	uint32_t memoryBarrierCount = 0;
+
+	vector<VkBufferMemoryBarrier> bufferBarriers;
+	if (step == HANDOFF_SAME_QUEUE)
+		memoryBarrierCount = bufferCopies.empty() ? 0 : 1;
+	else {
+		for (const auto &copy : bufferCopies) {
+			VkBufferMemoryBarrier bufferBarrier = {};
+			bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			bufferBarrier.srcAccessMask = srcAccess;
+			bufferBarrier.dstAccessMask = step != HANDOFF_RELEASE ? BUFFER_READ_ACCESS : 0;
+			bufferBarrier.srcQueueFamilyIndex = srcQueueFamily;
+			bufferBarrier.dstQueueFamilyIndex = dstQueueFamily;
+			bufferBarrier.buffer = copy.dst->getBuffer();
+			bufferBarrier.offset = copy.region.dstOffset;
+			bufferBarrier.size = copy.region.size;
+			bufferBarriers.push_back(bufferBarrier);
+		}
+	}
+
+	if (memoryBarrierCount == 0 && bufferBarriers.empty() && imageBarriers.empty())
+		return;
+
+	// the acquire is ordered after the semaphore wait on UPLOAD_READ_STAGES
+	VkPipelineStageFlags srcStage = step != HANDOFF_ACQUIRE ? VK_PIPELINE_STAGE_TRANSFER_BIT : UPLOAD_READ_STAGES;
+	VkPipelineStageFlags dstStage = step != HANDOFF_RELEASE ? UPLOAD_READ_STAGES : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer,
+		srcStage, dstStage, 0,
+		memoryBarrierCount, &memoryBarrier,
+		uint32_t(bufferBarriers.size()), bufferBarriers.data(),
+		uint32_t(imageBarriers.size()), imageBarriers.data());
+}
+
+void UploadBatch::recordMipmaps(VkCommandBuffer commandBuffer)
+{
+	for (const auto &copy : textureCopies)
+		if (copy.generateMipmaps)
+			copy.dst->generateMipmaps(commandBuffer);
+}
+
+// One barrier for all of them, before any layer copies into them
+void UploadBatch::recordTransitions(VkCommandBuffer commandBuffer)
+{
+	if (transitions.empty())
+		return;
+
+	vector<VkImageMemoryBarrier> imageBarriers;
+	for (auto texture : transitions)
+		imageBarriers.push_back(textureBarrier(texture,
+			0, VK_ACCESS_SHADER_READ_BIT,
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL));
+
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, UPLOAD_READ_STAGES, 0,
+		0, nullptr,
+		0, nullptr,
+		uint32_t(imageBarriers.size()), imageBarriers.data());
+}
+
+// Layer contents are discarded, so this only has to wait for earlier reads
+void UploadBatch::recordLayerCopies(VkCommandBuffer commandBuffer)
+{
+	if (layerCopies.empty())
+		return;
+
+	vector<VkImageMemoryBarrier> imageBarriers;
+	for (const auto &copy : layerCopies)
+		imageBarriers.push_back(textureBarrier(copy.dst,
+			0, VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
+			copy.arrayLayer));
+
+	vkCmdPipelineBarrier(commandBuffer,
+		UPLOAD_READ_STAGES, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+		0, nullptr,
+		0, nullptr,
+		uint32_t(imageBarriers.size()), imageBarriers.data());
+
+	for (const auto &copy : layerCopies) {
+		auto texture = copy.dst;
+		auto layout = texture->getLayout();
+		layout.arrayLayers = 1;
+
+		vector<VkBufferImageCopy> copyRegions(layout.mipLevels);
+		for (auto mipLevel = 0; mipLevel < layout.mipLevels; ++mipLevel) {
+			auto &copyRegion = copyRegions[mipLevel];
+			copyRegion = {};
+			copyRegion.bufferOffset = copy.src.offset + layout.getSubresourceOffset(mipLevel);
+			copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			copyRegion.imageSubresource.mipLevel = mipLevel;
+			copyRegion.imageSubresource.baseArrayLayer = copy.arrayLayer;
+			copyRegion.imageSubresource.layerCount = 1;
+			copyRegion.imageExtent.width = texture->getWidth(mipLevel);
+			copyRegion.imageExtent.height = texture->getHeight(mipLevel);
+			copyRegion.imageExtent.depth = texture->getDepth(mipLevel);
+		}
+
+		vkCmdCopyBufferToImage(commandBuffer, copy.src.buffer->getBuffer(), texture->getImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, uint32_t(copyRegions.size()), copyRegions.data());
+	}
+
+	imageBarriers.clear();
+	for (const auto &copy : layerCopies)
+		imageBarriers.push_back(textureBarrier(copy.dst,
+			VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
+			copy.arrayLayer));
+
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, UPLOAD_READ_STAGES, 0,
+		0, nullptr,
+		0, nullptr,
+		uint32_t(imageBarriers.size()), imageBarriers.data());
+}
+
+static void endCommandBuffer(VkCommandBuffer commandBuffer)
+{
+	VkResult err = vkEndCommandBuffer(commandBuffer);
+	assert(err == VK_SUCCESS);
+}
+
+UploadToken UploadBatch::submit()
+{
+	UploadToken token;
+	if (empty()) {
+		token.submission = lastSubmission;
+		return token;
+	}
+
+	collectUploads();
+
+	auto submission = std::make_shared<UploadSubmission>();
+	submission->fence = createFence(0);
+	submission->graphicsCommandBuffer = beginCommandBuffer(&graphicsCommandPool, graphicsQueueFamily);
+	submission->transferCommandBuffer = VK_NULL_HANDLE;
+	submission->semaphore = VK_NULL_HANDLE;
+
+	VkResult err;
+	if (useTransferQueue() && !(bufferCopies.empty() && textureCopies.empty())) {
+		submission->transferCommandBuffer = beginCommandBuffer(&transferCommandPool, transferQueueFamily);
+		submission->semaphore = createSemaphore();
+
+		recordCopies(submission->transferCommandBuffer);
+		recordHandoff(submission->transferCommandBuffer, HANDOFF_RELEASE);
+		endCommandBuffer(submission->transferCommandBuffer);
+
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &submission->transferCommandBuffer;
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &submission->semaphore;
+
+		err = vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE);
+		assert(err == VK_SUCCESS);
+
+		recordHandoff(submission->graphicsCommandBuffer, HANDOFF_ACQUIRE);
+		recordMipmaps(submission->graphicsCommandBuffer);
+	} else {
+		recordCopies(submission->graphicsCommandBuffer);
+		recordMipmaps(submission->graphicsCommandBuffer);
+		recordHandoff(submission->graphicsCommandBuffer, HANDOFF_SAME_QUEUE);
+	}
+	recordTransitions(submission->graphicsCommandBuffer);
+	recordLayerCopies(submission->graphicsCommandBuffer);
+	endCommandBuffer(submission->graphicsCommandBuffer);
+
+	// staging that was copied from is recycled along with the fence
+	for (auto it = staging.begin(); it != staging.end(); ) {
+		if (it->copied) {
+			if (it->spill)
+				submission->spills.push_back(std::move(it->spill));
+			else
+				submission->ringPositions.push_back(it->ringPosition);
+			it = staging.erase(it);
+		} else
+			++it;
+	}
+
+	// the graphics submit waits for the transfer one, so its fence covers both
+	VkPipelineStageFlags waitDstStageMask = UPLOAD_READ_STAGES;
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &submission->graphicsCommandBuffer;
+	if (submission->semaphore != VK_NULL_HANDLE) {
+		submitInfo.waitSemaphoreCount = 1;
+		submitInfo.pWaitSemaphores = &submission->semaphore;
+		submitInfo.pWaitDstStageMask = &waitDstStageMask;
+	}
+
+	err = vkQueueSubmit(graphicsQueue, 1, &submitInfo, submission->fence);
+	assert(err == VK_SUCCESS);
+
+	inFlight.push_back(submission);
+
+	bufferCopies.clear();
+	textureCopies.clear();
+	layerCopies.clear();
+	transitions.clear();
+
+	lastSubmission = submission;
+	token.submission = submission;
+	return token;
+}
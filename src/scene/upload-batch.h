@@ -0,0 +1,144 @@
+#ifndef UPLOAD_BATCH_H
+#define UPLOAD_BATCH_H
+
+#include "buffer.h"
+
+#include <memory>
+#include <vector>
+
+class TextureBase;
+struct UploadSubmission;
+
+// Completion of a submitted UploadBatch; a default-constructed token is complete
+class UploadToken {
+public:
+	bool isComplete() const;
+	void wait() const;
+
+private:
+	friend class UploadBatch;
+	std::shared_ptr<UploadSubmission> submission;
+};
+
+// Mapped staging memory to fill before recording a copy from it
+struct StagingRegion {
+	const StagingBuffer *buffer;
+	VkDeviceSize offset;
+	VkDeviceSize size;
+	void *data;
+};
+
+/*
+ * Records copies from staging memory into any number of buffers and
+ * textures, and submits them as one command buffer with one fence. The
+ * layout transitions of all textures are merged into one barrier before
+ * and one after the copies.
+ *
+ * Staging memory comes from a shared ring, and is recycled when the fence
+ * of the submit that read it signals. When the ring is full, the copies
+ * recorded so far are submitted early and waited for; allocations larger
+ * than the ring spill into dedicated buffers.
+ *
+ * With a transfer-only queue family, the copies run on the transfer queue,
+ * and ownership is handed over to the graphics queue, which waits on a
+ * semaphore and generates mipmaps. Otherwise everything runs on the
+ * graphics queue.
+ *
+ * This is not thread-safe.
+ */
+class UploadBatch {
+public:
+	UploadBatch() {}
+	~UploadBatch();
+
+	UploadBatch(const UploadBatch &) = delete;
+	UploadBatch &operator=(const UploadBatch &) = delete;
+
+	// Allocations up to this size share the ring, larger ones spill
+	static VkDeviceSize getStagingCapacity();
+
+	// alignment must be a power of two; texture copies need a multiple of the texel block size
+	StagingRegion allocateStaging(VkDeviceSize size, VkDeviceSize alignment = 16);
+
+	void copyBuffer(const StagingRegion &src, Buffer *dst, VkDeviceSize dstOffset = 0);
+
+	// src holds the texture's layout. With generateMipmaps, it holds only
+	// mip 0, and the remaining levels are blitted from it; that needs a
+	// format that passes TextureBase::canGenerateMipmaps().
+	void copyMipChain(const StagingRegion &src, TextureBase *dst, bool generateMipmaps = false);
+
+	// Overwrite the mip chain of one array layer of a texture that may be in
+	// use. To order this after earlier rendering, it always runs on the
+	// graphics queue. src holds the layer as a texture with one array layer.
+	void copyLayer(const StagingRegion &src, TextureBase *dst, int arrayLayer);
+
+	// Move all of dst into SHADER_READ_ONLY_OPTIMAL, leaving its contents
+	// undefined, so it can be sampled before all of its layers are copied
+	void transitionToShaderRead(TextureBase *dst);
+
+	// Give back an allocation no copy will be recorded from, e.g. because
+	// filling it failed. Otherwise it stays allocated until the batch dies.
+	void releaseStaging(const StagingRegion &region);
+
+	bool empty() const
+	{
+		return bufferCopies.empty() && textureCopies.empty() && layerCopies.empty() && transitions.empty();
+	}
+
+	// The token covers everything submitted from this batch so far
+	UploadToken submit();
+
+private:
+	enum HandoffStep {
+		HANDOFF_SAME_QUEUE,
+		HANDOFF_RELEASE,
+		HANDOFF_ACQUIRE
+	};
+
+	void recordCopies(VkCommandBuffer commandBuffer);
+	void recordHandoff(VkCommandBuffer commandBuffer, HandoffStep step);
+	void recordMipmaps(VkCommandBuffer commandBuffer);
+	void recordTransitions(VkCommandBuffer commandBuffer);
+	void recordLayerCopies(VkCommandBuffer commandBuffer);
+	void markCopied(const StagingRegion &src);
+	void releaseStaging();
+
+	struct BufferCopy {
+		const StagingBuffer *src;
+		Buffer *dst;
+		VkBufferCopy region;
+	};
+
+	struct TextureCopy {
+		StagingRegion src;
+		TextureBase *dst;
+		bool generateMipmaps;
+	};
+
+	struct LayerCopy {
+		StagingRegion src;
+		TextureBase *dst;
+		int arrayLayer;
+	};
+
+	// only allocations with copies recorded from them go along with a submit
+	struct StagingAllocation {
+		StagingRegion region;
+		uint64_t ringPosition;
+		std::unique_ptr<StagingBuffer> spill;
+		bool copied;
+	};
+
+	std::vector<BufferCopy> bufferCopies;
+	std::vector<TextureCopy> textureCopies;
+	std::vector<LayerCopy> layerCopies;
+	std::vector<TextureBase *> transitions;
+	std::vector<StagingAllocation> staging;
+	std::shared_ptr<UploadSubmission> lastSubmission;
+};
+
+// Wait for every submitted batch, and release their resources along with
+// the staging ring. Call this before vulkan::setupCleanup().
+void finishUploads();
+
+#endif // UPLOAD_BATCH_H
@@ -1,19 +1,201 @@
 #include "shader.h"
 #include "core/memorymappedfile.h"
+#include "core/assetpack.h"
+#include "core/hash.h"
 
-VkShaderModule loadShaderModule(const std::string &path)
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+using std::vector;
+using std::runtime_error;
+using std::lock_guard;
+using std::mutex;
+
+// loadShaderModule() may run on any thread
+static mutex reflectionMutex;
+static std::unordered_map<VkShaderModule, ShaderReflection> reflections;
+
+static VkShaderModule createShaderModule(const void *code, size_t codeSize)
 {
-	MemoryMappedFile shaderCode(path);
-	assert(shaderCode.getSize() > 0);
+	// before creating anything, so malformed modules don't leak; this also throws for empty files
+	auto reflection = reflectShader(code, codeSize);
 
 	VkShaderModuleCreateInfo moduleCreateInfo = {};
 	moduleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	moduleCreateInfo.codeSize = shaderCode.getSize();
-	moduleCreateInfo.pCode = static_cast<const uint32_t *>(shaderCode.getData());
+	moduleCreateInfo.codeSize = codeSize;
+	moduleCreateInfo.pCode = static_cast<const uint32_t *>(code);
 
 	VkShaderModule shaderModule;
 	VkResult err = vkCreateShaderModule(vulkan::device, &moduleCreateInfo, nullptr, &shaderModule);
 	assert(!err);
 
+	lock_guard<mutex> lock(reflectionMutex);
+	reflections[shaderModule] = std::move(reflection);
 	return shaderModule;
 }
+
+VkShaderModule loadShaderModule(const std::string &path)
+{
+	MemoryMappedFile shaderCode(path, MAP_HINT_SEQUENTIAL | MAP_HINT_PREFETCH);
+	return createShaderModule(shaderCode.getData(), shaderCode.getSize());
+}
+
+VkShaderModule loadShaderModule(const AssetPack &pack, const std::string &name)
+{
+	const auto &entry = pack.getEntry(name);
+	if (entry.type != ASSET_PACK_BLOB)
+		throw std::runtime_error("unexpected asset type: " + name);
+
+	return createShaderModule(pack.getData(entry), size_t(entry.size));
+}
+
+const ShaderReflection &getShaderReflection(VkShaderModule shaderModule)
+{
+	// entries are never removed, and unordered_map doesn't move them
+	lock_guard<mutex> lock(reflectionMutex);
+	auto reflection = reflections.find(shaderModule);
+	if (reflection == reflections.end())
+		throw runtime_error("shader module wasn't loaded with loadShaderModule()!");
+
+	return reflection->second;
+}
+
+namespace
+{
+	// layouts are keyed on their create info, flattened into words
+	typedef vector<uint64_t> LayoutKey;
+
+	struct LayoutKeyHash {
+		size_t operator()(const LayoutKey &key) const
+		{
+			return size_t(hash64(key.data(), key.size() * sizeof(uint64_t)));
+		}
+	};
+
+	template <typename T>
+	uint64_t getHandleBits(T handle)
+	{
+		uint64_t ret = 0;
+		memcpy(&ret, &handle, sizeof(handle));
+		return ret;
+	}
+}
+
+static mutex layoutMutex;
+static std::unordered_map<LayoutKey, VkDescriptorSetLayout, LayoutKeyHash> descriptorSetLayouts;
+static std::unordered_map<LayoutKey, VkPipelineLayout, LayoutKeyHash> pipelineLayouts;
+
+VkDescriptorSetLayout getSharedDescriptorSetLayout(const vector<VkDescriptorSetLayoutBinding> &layoutBindings)
+{
+	// binding order doesn't change the layout
+	auto sortedBindings = layoutBindings;
+	std::sort(sortedBindings.begin(), sortedBindings.end(), [](const VkDescriptorSetLayoutBinding &a, const VkDescriptorSetLayoutBinding &b) {
+		return a.binding < b.binding;
+	});
+
+	LayoutKey key;
+	for (auto &binding : sortedBindings) {
+		key.push_back(binding.binding);
+		key.push_back(binding.descriptorType);
+		key.push_back(binding.descriptorCount);
+		key.push_back(binding.stageFlags);
+		key.push_back(binding.pImmutableSamplers != nullptr);
+		if (binding.pImmutableSamplers != nullptr)
+			for (auto i = 0u; i < binding.descriptorCount; ++i)
+				key.push_back(getHandleBits(binding.pImmutableSamplers[i]));
+	}
+
+	lock_guard<mutex> lock(layoutMutex);
+	auto &descriptorSetLayout = descriptorSetLayouts[key];
+	if (descriptorSetLayout == VK_NULL_HANDLE)
+		descriptorSetLayout = vulkan::createDescriptorSetLayout(sortedBindings);
+
+	return descriptorSetLayout;
+}
+
+VkPipelineLayout getSharedPipelineLayout(const vector<VkDescriptorSetLayout> &setLayouts, const vector<VkPushConstantRange> &pushConstantRanges)
+{
+	LayoutKey key;
+	key.push_back(setLayouts.size());
+	for (auto setLayout : setLayouts)
+		key.push_back(getHandleBits(setLayout));
+	for (auto &range : pushConstantRanges) {
+		key.push_back(range.stageFlags);
+		key.push_back(range.offset);
+		key.push_back(range.size);
+	}
+
+	lock_guard<mutex> lock(layoutMutex);
+	auto &pipelineLayout = pipelineLayouts[key];
+	if (pipelineLayout == VK_NULL_HANDLE)
+		pipelineLayout = vulkan::createPipelineLayout(setLayouts, pushConstantRanges);
+
+	return pipelineLayout;
+}
+
+// dynamic buffers are declared just like the plain ones in SPIR-V
+static bool isCompatibleDescriptorType(VkDescriptorType reflected, VkDescriptorType type)
+{
+	if (reflected == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER && type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC)
+		return true;
+	if (reflected == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER && type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC)
+		return true;
+	return reflected == type;
+}
+
+ShaderProgram::ShaderProgram(const vector<ShaderStage> &stages, const vector<ShaderDescriptor> &descriptors) :
+	stages(stages)
+{
+	workgroupSize[0] = workgroupSize[1] = workgroupSize[2] = 1;
+
+	std::map<uint32_t, VkDescriptorSetLayoutBinding> bindings;
+	vector<VkPushConstantRange> pushConstantRanges;
+	for (auto &stage : stages) {
+		auto &reflection = stage.getReflection();
+
+		for (auto &binding : reflection.bindings) {
+			auto merged = bindings.find(binding.binding);
+			if (merged == bindings.end()) {
+				bindings[binding.binding] = binding;
+				continue;
+			}
+
+			if (merged->second.descriptorType != binding.descriptorType ||
+			    merged->second.descriptorCount != binding.descriptorCount)
+				throw runtime_error("stages disagree on a descriptor!");
+			merged->second.stageFlags |= binding.stageFlags;
+		}
+
+		// a range per stage; ranges of different stages may overlap
+		pushConstantRanges.insert(pushConstantRanges.end(), reflection.pushConstantRanges.begin(), reflection.pushConstantRanges.end());
+
+		if (reflection.stage == VK_SHADER_STAGE_COMPUTE_BIT)
+			memcpy(workgroupSize, reflection.workgroupSize, sizeof(workgroupSize));
+	}
+
+	for (auto &descriptor : descriptors) {
+		auto binding = descriptor.getBinding();
+		auto merged = bindings.find(binding.binding);
+		if (merged == bindings.end())
+			throw runtime_error("descriptor isn't used by any stage!");
+
+		if (!isCompatibleDescriptorType(merged->second.descriptorType, binding.descriptorType) ||
+		    merged->second.descriptorCount != binding.descriptorCount)
+			throw runtime_error("descriptor doesn't match the shaders!");
+
+		merged->second.descriptorType = binding.descriptorType;
+		merged->second.stageFlags |= binding.stageFlags;
+		merged->second.pImmutableSamplers = binding.pImmutableSamplers;
+	}
+
+	vector<VkDescriptorSetLayoutBinding> layoutBindings;
+	layoutBindings.reserve(bindings.size());
+	for (auto &binding : bindings)
+		layoutBindings.push_back(binding.second);
+
+	descriptorSetLayout = getSharedDescriptorSetLayout(layoutBindings);
+	pipelineLayout = getSharedPipelineLayout({ descriptorSetLayout }, pushConstantRanges);
+}
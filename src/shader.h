@@ -2,15 +2,32 @@
 #define SHADER_H
 
 #include "vkinstance.h"
+#include "shaderreflection.h"
 
+class AssetPack;
+
+// Also reflects the module's SPIR-V, for ShaderStage to pick up
 VkShaderModule loadShaderModule(const std::string &path);
+VkShaderModule loadShaderModule(const AssetPack &pack, const std::string &name);
+
+// for modules made by loadShaderModule(); throws for any other
+const ShaderReflection &getShaderReflection(VkShaderModule shaderModule);
+
+// Hash-consed layouts: identical arguments give the same object, which
+// lives until exit. Sharing them keeps descriptor sets bound across
+// pipelines whose layouts match.
+VkDescriptorSetLayout getSharedDescriptorSetLayout(const std::vector<VkDescriptorSetLayoutBinding> &layoutBindings);
+VkPipelineLayout getSharedPipelineLayout(const std::vector<VkDescriptorSetLayout> &descriptorSetLayouts, const std::vector<VkPushConstantRange> &pushConstantRanges);
 
 class ShaderStage {
 public:
 	ShaderStage(VkShaderStageFlagBits shaderStage, VkShaderModule shaderModule) :
 		shaderStage(shaderStage),
-		shaderModule(shaderModule)
+		shaderModule(shaderModule),
+		reflection(getShaderReflection(shaderModule))
 	{
+		if (reflection.stage != shaderStage)
+			throw std::runtime_error("shader stage doesn't match the module!");
 	}
 
 	VkPipelineShaderStageCreateInfo getPipelineShaderStageCreateInfo() const
@@ -23,11 +40,15 @@ public:
 		return ret;
 	}
 
+	const ShaderReflection &getReflection() const { return reflection; }
+
 private:
 	VkShaderStageFlagBits shaderStage;
 	VkShaderModule shaderModule;
+	ShaderReflection reflection;
 };
 
+// Overrides what reflection can't tell about a binding, like whether a buffer is dynamic, or its immutable samplers
 class ShaderDescriptor {
 public:
 	ShaderDescriptor(int binding, VkDescriptorType descriptorType, int count, VkShaderStageFlags stageFlags, const std::vector<VkSampler> &immutableSamplers = {}) :
@@ -41,7 +62,8 @@ public:
 		assert(immutableSamplers.size() == 0 || immutableSamplers.size() == count);
 	}
 
-	VkDescriptorSetLayoutBinding getBinding()
+	// points into immutableSamplers, so only valid while this is
+	VkDescriptorSetLayoutBinding getBinding() const
 	{
 		VkDescriptorSetLayoutBinding ret;
 		ret.binding = uint32_t(binding);
@@ -61,28 +83,31 @@ private:
 };
 
 
+/*
+ * The descriptor set layout and push constant ranges come from the stages'
+ * SPIR-V, merged across stages. descriptors only need to list bindings to
+ * override; a binding no stage uses, or one that doesn't match what the
+ * shaders declare, throws.
+ */
 class ShaderProgram {
 public:
-	ShaderProgram(const std::vector<ShaderStage> &stages, const std::vector<ShaderDescriptor> &descriptors, const std::vector<VkPushConstantRange> &pushConstantRanges = {}) :
-		stages(stages)
-	{
-		std::vector<VkDescriptorSetLayoutBinding> layoutBindings;
-		layoutBindings.reserve(descriptors.size());
-		for (auto descriptor : descriptors)
-			layoutBindings.push_back(descriptor.getBinding());
-
-		descriptorSetLayout = vulkan::createDescriptorSetLayout(layoutBindings);
-		pipelineLayout = vulkan::createPipelineLayout({ descriptorSetLayout }, pushConstantRanges);
-	}
+	ShaderProgram(const std::vector<ShaderStage> &stages, const std::vector<ShaderDescriptor> &descriptors = {});
 
 	VkDescriptorSetLayout getDescriptorSetLayout() const { return descriptorSetLayout; }
 	VkPipelineLayout getPipelineLayout() const { return pipelineLayout; }
 
+	// the compute stage's local size along dimension; 1 without one
+	uint32_t getWorkgroupSize(int dimension) const
+	{
+		assert(dimension >= 0 && dimension < 3);
+		return workgroupSize[dimension];
+	}
+
 	std::vector<VkPipelineShaderStageCreateInfo> getPipelineShaderStageCreateInfos() const
 	{
 		std::vector<VkPipelineShaderStageCreateInfo> ret;
 		ret.reserve(stages.size());
-		for (auto stage : stages)
+		for (auto &stage : stages)
 			ret.push_back(stage.getPipelineShaderStageCreateInfo());
 
 		return ret;
@@ -91,7 +116,26 @@ public:
 private:
 	VkDescriptorSetLayout descriptorSetLayout;
 	VkPipelineLayout pipelineLayout;
+	uint32_t workgroupSize[3];
 	const std::vector<ShaderStage> stages;
 };
 
+inline VkPipeline createComputePipeline(const ShaderProgram &shaderProgram)
+{
+	VkComputePipelineCreateInfo computePipelineCreateInfo = {};
+	computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+
+	auto stages = shaderProgram.getPipelineShaderStageCreateInfos();
+	assert(stages.size() == 1);
+	assert(stages[0].stage == VK_SHADER_STAGE_COMPUTE_BIT);
+
+	computePipelineCreateInfo.stage = stages[0];
+	computePipelineCreateInfo.layout = shaderProgram.getPipelineLayout();
+
+	VkPipeline computePipeline;
+	auto err = vkCreateComputePipelines(vulkan::device, vulkan::pipelineCache, 1, &computePipelineCreateInfo, nullptr, &computePipeline);
+	assert(err == VK_SUCCESS);
+	return computePipeline;
+}
+
 #endif /* SHADER_H */
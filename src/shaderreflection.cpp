@@ -0,0 +1,389 @@
+#include "shaderreflection.h"
+
+#include <algorithm>
+#include <cstring>
+
+using std::vector;
+using std::runtime_error;
+
+// the few parts of the SPIR-V spec reflection needs
+#define SPIRV_MAGIC 0x07230203
+#define SPIRV_HEADER_WORDS 5
+
+enum SpirvOp {
+	OP_ENTRY_POINT = 15,
+	OP_EXECUTION_MODE = 16,
+	OP_TYPE_INT = 21,
+	OP_TYPE_FLOAT = 22,
+	OP_TYPE_VECTOR = 23,
+	OP_TYPE_MATRIX = 24,
+	OP_TYPE_IMAGE = 25,
+	OP_TYPE_SAMPLER = 26,
+	OP_TYPE_SAMPLED_IMAGE = 27,
+	OP_TYPE_ARRAY = 28,
+	OP_TYPE_RUNTIME_ARRAY = 29,
+	OP_TYPE_STRUCT = 30,
+	OP_TYPE_POINTER = 32,
+	OP_CONSTANT = 43,
+	OP_SPEC_CONSTANT = 50,
+	OP_VARIABLE = 59,
+	OP_DECORATE = 71,
+	OP_MEMBER_DECORATE = 72,
+};
+
+enum SpirvDecoration {
+	DECORATION_BLOCK = 2,
+	DECORATION_BUFFER_BLOCK = 3,
+	DECORATION_ARRAY_STRIDE = 6,
+	DECORATION_MATRIX_STRIDE = 7,
+	DECORATION_BINDING = 33,
+	DECORATION_DESCRIPTOR_SET = 34,
+	DECORATION_OFFSET = 35,
+};
+
+enum SpirvStorageClass {
+	STORAGE_CLASS_UNIFORM_CONSTANT = 0,
+	STORAGE_CLASS_UNIFORM = 2,
+	STORAGE_CLASS_PUSH_CONSTANT = 9,
+	STORAGE_CLASS_STORAGE_BUFFER = 12,
+};
+
+#define EXECUTION_MODE_LOCAL_SIZE 17
+#define IMAGE_DIM_BUFFER 5
+#define IMAGE_DIM_SUBPASS_DATA 6
+
+namespace
+{
+	struct Member {
+		Member() : offset(0), matrixStride(0) {}
+		uint32_t offset, matrixStride;
+	};
+
+	// whatever an id is defined or decorated as
+	struct Id {
+		Id() : opcode(0), binding(UINT32_MAX), set(0), arrayStride(0), block(false), bufferBlock(false) {}
+
+		uint32_t opcode;
+		vector<uint32_t> operands; // the words after the result id
+
+		uint32_t binding, set, arrayStride;
+		bool block, bufferBlock;
+		vector<Member> members;
+	};
+
+	class Module {
+	public:
+		Module(const uint32_t *words, size_t wordCount);
+
+		ShaderReflection reflect() const;
+
+	private:
+		const Id &getId(uint32_t id) const
+		{
+			if (id >= ids.size())
+				throw runtime_error("SPIR-V id out of range!");
+			return ids[id];
+		}
+
+		const Id &getType(uint32_t id, uint32_t opcode) const
+		{
+			auto &type = getId(id);
+			if (type.opcode != opcode)
+				throw runtime_error("unexpected SPIR-V type!");
+			return type;
+		}
+
+		uint32_t getArrayLength(const Id &arrayType) const;
+		uint32_t getTypeSize(uint32_t typeId, uint32_t matrixStride = 0) const;
+		VkDescriptorType getDescriptorType(const Id &variableType, uint32_t storageClass) const;
+
+		vector<Id> ids;
+		vector<uint32_t> variables;
+
+		uint32_t executionModel, entryPoint;
+		uint32_t localSize[3];
+	};
+}
+
+static VkShaderStageFlagBits getShaderStage(uint32_t executionModel)
+{
+	switch (executionModel) {
+	case 0: return VK_SHADER_STAGE_VERTEX_BIT;
+	case 1: return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+	case 2: return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+	case 3: return VK_SHADER_STAGE_GEOMETRY_BIT;
+	case 4: return VK_SHADER_STAGE_FRAGMENT_BIT;
+	case 5: return VK_SHADER_STAGE_COMPUTE_BIT;
+	default: throw runtime_error("unsupported SPIR-V execution model!");
+	}
+}
+
+Module::Module(const uint32_t *words, size_t wordCount) :
+	executionModel(UINT32_MAX),
+	entryPoint(UINT32_MAX)
+{
+	if (wordCount < SPIRV_HEADER_WORDS || words[0] != SPIRV_MAGIC)
+		throw runtime_error("not a SPIR-V module!");
+
+	ids.resize(words[3]); // the id bound
+	localSize[0] = localSize[1] = localSize[2] = 1;
+
+	for (auto pos = size_t(SPIRV_HEADER_WORDS); pos < wordCount; ) {
+		auto opcode = words[pos] & 0xffff;
+		auto count = words[pos] >> 16;
+		if (count == 0 || pos + count > wordCount)
+			throw runtime_error("truncated SPIR-V module!");
+
+		auto operands = words + pos + 1;
+		auto operandCount = count - 1;
+		pos += count;
+
+		switch (opcode) {
+		case OP_ENTRY_POINT:
+			if (operandCount >= 3 && strncmp(reinterpret_cast<const char *>(operands + 2), "main", 4 * (operandCount - 2)) == 0) {
+				executionModel = operands[0];
+				entryPoint = operands[1];
+			}
+			break;
+
+		case OP_EXECUTION_MODE:
+			// entry points are declared before their execution modes
+			if (operandCount >= 5 && operands[0] == entryPoint && operands[1] == EXECUTION_MODE_LOCAL_SIZE)
+				memcpy(localSize, operands + 2, sizeof(localSize));
+			break;
+
+		case OP_DECORATE:
+			if (operandCount >= 2) {
+				auto &id = ids.at(operands[0]);
+				switch (operands[1]) {
+				case DECORATION_BLOCK: id.block = true; break;
+				case DECORATION_BUFFER_BLOCK: id.bufferBlock = true; break;
+				case DECORATION_ARRAY_STRIDE: if (operandCount >= 3) id.arrayStride = operands[2]; break;
+				case DECORATION_BINDING: if (operandCount >= 3) id.binding = operands[2]; break;
+				case DECORATION_DESCRIPTOR_SET: if (operandCount >= 3) id.set = operands[2]; break;
+				}
+			}
+			break;
+
+		case OP_MEMBER_DECORATE:
+			if (operandCount >= 4) {
+				auto &id = ids.at(operands[0]);
+				if (id.members.size() <= operands[1])
+					id.members.resize(operands[1] + 1);
+
+				auto &member = id.members[operands[1]];
+				if (operands[2] == DECORATION_OFFSET)
+					member.offset = operands[3];
+				else if (operands[2] == DECORATION_MATRIX_STRIDE)
+					member.matrixStride = operands[3];
+			}
+			break;
+
+		case OP_TYPE_INT:
+		case OP_TYPE_FLOAT:
+		case OP_TYPE_VECTOR:
+		case OP_TYPE_MATRIX:
+		case OP_TYPE_IMAGE:
+		case OP_TYPE_SAMPLER:
+		case OP_TYPE_SAMPLED_IMAGE:
+		case OP_TYPE_ARRAY:
+		case OP_TYPE_RUNTIME_ARRAY:
+		case OP_TYPE_STRUCT:
+		case OP_TYPE_POINTER:
+			if (operandCount >= 1) {
+				auto &id = ids.at(operands[0]);
+				id.opcode = opcode;
+				id.operands.assign(operands + 1, operands + operandCount);
+			}
+			break;
+
+		case OP_CONSTANT:
+		case OP_SPEC_CONSTANT:
+		case OP_VARIABLE:
+			// these start with the result type
+			if (operandCount >= 2) {
+				auto &id = ids.at(operands[1]);
+				id.opcode = opcode;
+				id.operands.assign(operands, operands + operandCount);
+				id.operands.erase(id.operands.begin() + 1);
+
+				if (opcode == OP_VARIABLE)
+					variables.push_back(operands[1]);
+			}
+			break;
+		}
+	}
+
+	if (entryPoint == UINT32_MAX)
+		throw runtime_error("SPIR-V module has no main entry point!");
+}
+
+uint32_t Module::getArrayLength(const Id &arrayType) const
+{
+	assert(arrayType.opcode == OP_TYPE_ARRAY);
+	if (arrayType.operands.size() < 2)
+		throw runtime_error("malformed SPIR-V array type!");
+
+	// specialization constants count with their default value
+	auto &length = getId(arrayType.operands[1]);
+	if ((length.opcode != OP_CONSTANT && length.opcode != OP_SPEC_CONSTANT) || length.operands.size() < 2)
+		throw runtime_error("unsupported SPIR-V array length!");
+
+	return length.operands[1];
+}
+
+// the size a push constant member occupies, following its Offset/ArrayStride/MatrixStride decorations
+uint32_t Module::getTypeSize(uint32_t typeId, uint32_t matrixStride) const
+{
+	auto &type = getId(typeId);
+	switch (type.opcode) {
+	case OP_TYPE_INT:
+	case OP_TYPE_FLOAT:
+		return type.operands.at(0) / 8;
+
+	case OP_TYPE_VECTOR:
+		return getTypeSize(type.operands.at(0)) * type.operands.at(1);
+
+	case OP_TYPE_MATRIX:
+		if (matrixStride == 0)
+			matrixStride = getTypeSize(type.operands.at(0));
+		return matrixStride * type.operands.at(1);
+
+	case OP_TYPE_ARRAY: {
+		auto stride = type.arrayStride != 0 ? type.arrayStride : getTypeSize(type.operands.at(0), matrixStride);
+		return stride * getArrayLength(type);
+	}
+
+	case OP_TYPE_STRUCT: {
+		uint32_t size = 0;
+		for (auto i = 0u; i < type.operands.size(); ++i) {
+			auto member = i < type.members.size() ? type.members[i] : Member();
+			size = std::max(size, member.offset + getTypeSize(type.operands[i], member.matrixStride));
+		}
+		return size;
+	}
+
+	default:
+		throw runtime_error("unsupported SPIR-V push constant type!");
+	}
+}
+
+VkDescriptorType Module::getDescriptorType(const Id &variableType, uint32_t storageClass) const
+{
+	switch (storageClass) {
+	case STORAGE_CLASS_UNIFORM:
+		if (variableType.bufferBlock)
+			return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		if (variableType.block)
+			return VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		break;
+
+	case STORAGE_CLASS_STORAGE_BUFFER:
+		return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+
+	case STORAGE_CLASS_UNIFORM_CONSTANT:
+		switch (variableType.opcode) {
+		case OP_TYPE_SAMPLER:
+			return VK_DESCRIPTOR_TYPE_SAMPLER;
+
+		case OP_TYPE_SAMPLED_IMAGE: {
+			auto &image = getType(variableType.operands.at(0), OP_TYPE_IMAGE);
+			return image.operands.at(1) == IMAGE_DIM_BUFFER ? VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		}
+
+		case OP_TYPE_IMAGE: {
+			// sampled type, dim, depth, arrayed, MS, sampled (1 for sampled, 2 for storage)
+			auto dim = variableType.operands.at(1);
+			auto storage = variableType.operands.at(5) == 2;
+			if (dim == IMAGE_DIM_SUBPASS_DATA)
+				return VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+			if (dim == IMAGE_DIM_BUFFER)
+				return storage ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+			return storage ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+		}
+		}
+		break;
+	}
+
+	throw runtime_error("unsupported SPIR-V descriptor type!");
+}
+
+ShaderReflection Module::reflect() const
+{
+	ShaderReflection ret;
+	ret.stage = getShaderStage(executionModel);
+	memcpy(ret.workgroupSize, localSize, sizeof(ret.workgroupSize));
+
+	for (auto variableId : variables) {
+		auto &variable = ids[variableId];
+		auto storageClass = variable.operands.at(1);
+		if (storageClass != STORAGE_CLASS_UNIFORM_CONSTANT &&
+		    storageClass != STORAGE_CLASS_UNIFORM &&
+		    storageClass != STORAGE_CLASS_STORAGE_BUFFER &&
+		    storageClass != STORAGE_CLASS_PUSH_CONSTANT)
+			continue;
+
+		auto &pointer = getType(variable.operands.at(0), OP_TYPE_POINTER);
+		auto typeId = pointer.operands.at(1);
+
+		if (storageClass == STORAGE_CLASS_PUSH_CONSTANT) {
+			auto &block = getType(typeId, OP_TYPE_STRUCT);
+			uint32_t offset = UINT32_MAX;
+			for (auto i = 0u; i < block.operands.size(); ++i)
+				offset = std::min(offset, i < block.members.size() ? block.members[i].offset : 0);
+
+			if (offset != UINT32_MAX) {
+				VkPushConstantRange range;
+				range.stageFlags = ret.stage;
+				range.offset = offset;
+				range.size = uint32_t(vulkan::alignSize(getTypeSize(typeId) - offset, 4));
+				ret.pushConstantRanges.push_back(range);
+			}
+			continue;
+		}
+
+		if (variable.binding == UINT32_MAX)
+			throw runtime_error("SPIR-V descriptor without a binding!");
+		if (variable.set != 0)
+			throw runtime_error("only descriptor set 0 is supported!");
+
+		// arrays of descriptors
+		uint32_t count = 1;
+		auto type = &getId(typeId);
+		while (type->opcode == OP_TYPE_ARRAY) {
+			count *= getArrayLength(*type);
+			type = &getId(type->operands.at(0));
+		}
+		if (type->opcode == OP_TYPE_RUNTIME_ARRAY)
+			throw runtime_error("unsized descriptor arrays are not supported!");
+
+		VkDescriptorSetLayoutBinding binding = {};
+		binding.binding = variable.binding;
+		binding.descriptorType = getDescriptorType(*type, storageClass);
+		binding.descriptorCount = count;
+		binding.stageFlags = ret.stage;
+		binding.pImmutableSamplers = nullptr;
+		ret.bindings.push_back(binding);
+	}
+
+	std::sort(ret.bindings.begin(), ret.bindings.end(), [](const VkDescriptorSetLayoutBinding &a, const VkDescriptorSetLayoutBinding &b) {
+		return a.binding < b.binding;
+	});
+	for (auto i = 1u; i < ret.bindings.size(); ++i)
+		if (ret.bindings[i].binding == ret.bindings[i - 1].binding)
+			throw runtime_error("SPIR-V module binds two descriptors to one binding!");
+
+	return ret;
+}
+
+ShaderReflection reflectShader(const void *code, size_t codeSize)
+{
+	if (codeSize % 4 != 0)
+		throw runtime_error("not a SPIR-V module!");
+
+	// copied, as asset pack entries needn't be 4-byte aligned
+	vector<uint32_t> words(codeSize / 4);
+	memcpy(words.data(), code, codeSize);
+
+	return Module(words.data(), words.size()).reflect();
+}
@@ -0,0 +1,24 @@
+#ifndef SHADERREFLECTION_H
+#define SHADERREFLECTION_H
+
+#include "vkinstance.h"
+
+// What a SPIR-V module declares for its "main" entry point
+struct ShaderReflection {
+	VkShaderStageFlagBits stage;
+
+	// Descriptor set 0, sorted by binding. Uniform and storage buffers
+	// come out non-dynamic, as SPIR-V can't tell the difference.
+	std::vector<VkDescriptorSetLayoutBinding> bindings;
+
+	// at most one, covering the push constant block
+	std::vector<VkPushConstantRange> pushConstantRanges;
+
+	// from the LocalSize execution mode; 1, 1, 1 for anything but compute
+	uint32_t workgroupSize[3];
+};
+
+// Throws on malformed modules and on descriptors outside set 0
+ShaderReflection reflectShader(const void *code, size_t codeSize);
+
+#endif // SHADERREFLECTION_H
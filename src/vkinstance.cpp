@@ -5,6 +5,8 @@
 #include <cstring>
 
 #include "vkinstance.h"
+#include "core/memorymappedfile.h"
+#include "core/replacefile.h"
 
 #ifdef WIN32
 #define WIN32_LEAN_AND_MEAN
@@ -16,6 +18,7 @@ using namespace vulkan;
 using std::vector;
 using std::function;
 using std::runtime_error;
+using std::string;
 
 VkInstance vulkan::instance;
 VkDevice vulkan::device;
@@ -25,6 +28,10 @@ VkPhysicalDeviceProperties vulkan::deviceProperties;
 VkPhysicalDeviceMemoryProperties vulkan::deviceMemoryProperties;
 uint32_t vulkan::graphicsQueueFamily = UINT32_MAX;
 VkQueue vulkan::graphicsQueue;
+uint32_t vulkan::transferQueueFamily = UINT32_MAX;
+VkQueue vulkan::transferQueue;
+VkPipelineCache vulkan::pipelineCache;
+static string pipelineCachePath;
 VkCommandPool setupCommandPool;
 VkDebugReportCallbackEXT vulkan::debugReportCallback;
 
@@ -125,7 +132,81 @@ static uint32_t findQueueFamily(VkPhysicalDevice physicalDevice, VkQueueFlags re
 	throw runtime_error("failed to find queue!");
 }
 
-void vulkan::deviceInit(VkPhysicalDevice physicalDevice, function<bool(VkInstance, VkPhysicalDevice, uint32_t)> usableQueue)
+// A family that can transfer, but not draw or dispatch; usually a DMA engine
+static uint32_t findTransferOnlyQueueFamily(VkPhysicalDevice physicalDevice)
+{
+	uint32_t queueFamilyCount;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+
+	vector<VkQueueFamilyProperties> props(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, props.data());
+
+	for (uint32_t i = 0; i < queueFamilyCount; i++) {
+		auto queueFlags = props[i].queueFlags;
+		if ((queueFlags & VK_QUEUE_TRANSFER_BIT) && !(queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+			return i;
+	}
+
+	return UINT32_MAX;
+}
+
+// the header every pipeline cache starts with, whatever the driver puts after it
+struct PipelineCacheHeader {
+	uint32_t headerSize;
+	uint32_t headerVersion;
+	uint32_t vendorID;
+	uint32_t deviceID;
+	uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+};
+
+/*
+ * Drivers are meant to ignore caches from other devices or driver versions,
+ * but not all of them do so gracefully, so only hand over caches that
+ * match this device.
+ */
+static bool isPipelineCacheCompatible(const void *data, size_t size)
+{
+	PipelineCacheHeader header;
+	if (size < sizeof(header))
+		return false;
+	memcpy(&header, data, sizeof(header));
+
+	return header.headerSize >= sizeof(header) && header.headerSize <= size &&
+	       header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+	       header.vendorID == deviceProperties.vendorID &&
+	       header.deviceID == deviceProperties.deviceID &&
+	       memcmp(header.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+static VkPipelineCache createPipelineCache(const void *initialData, size_t initialDataSize)
+{
+	VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
+	pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	pipelineCacheCreateInfo.initialDataSize = initialDataSize;
+	pipelineCacheCreateInfo.pInitialData = initialData;
+
+	VkPipelineCache ret;
+	VkResult err = vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &ret);
+	assert(err == VK_SUCCESS);
+	return ret;
+}
+
+static VkPipelineCache loadPipelineCache(const string &path)
+{
+	if (!path.empty()) {
+		try {
+			MemoryMappedFile file(path, MAP_HINT_SEQUENTIAL | MAP_HINT_PREFETCH);
+			if (isPipelineCacheCompatible(file.getData(), file.getSize()))
+				return createPipelineCache(file.getData(), file.getSize());
+		} catch (const runtime_error &) {
+			// no cache yet
+		}
+	}
+
+	return createPipelineCache(nullptr, 0);
+}
+
+void vulkan::deviceInit(VkPhysicalDevice physicalDevice, function<bool(VkInstance, VkPhysicalDevice, uint32_t)> usableQueue, const string &pipelineCachePath)
 {
 	vulkan::physicalDevice = physicalDevice;
 
@@ -133,23 +214,31 @@ void vulkan::deviceInit(VkPhysicalDevice physicalDevice, function<bool(VkInstanc
 	vkGetPhysicalDeviceFeatures(physicalDevice, &physicalDeviceFeatures);
 
 	enabledFeatures.samplerAnisotropy = physicalDeviceFeatures.samplerAnisotropy;
+	enabledFeatures.textureCompressionBC = physicalDeviceFeatures.textureCompressionBC;
 
 	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
 
 	graphicsQueueFamily = findQueueFamily(physicalDevice, VK_QUEUE_GRAPHICS_BIT, usableQueue);
 
-	VkDeviceQueueCreateInfo queueCreateInfo = {};
+	// uploads go to the graphics queue unless there's a dedicated one
+	transferQueueFamily = findTransferOnlyQueueFamily(physicalDevice);
+	if (transferQueueFamily == UINT32_MAX)
+		transferQueueFamily = graphicsQueueFamily;
+
+	VkDeviceQueueCreateInfo queueCreateInfos[2] = {};
 	float queuePriorities = 0.0f;
-	queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-	queueCreateInfo.queueFamilyIndex = graphicsQueueFamily;
-	queueCreateInfo.queueCount = 1;
-	queueCreateInfo.pQueuePriorities = &queuePriorities;
+	queueCreateInfos[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+	queueCreateInfos[0].queueFamilyIndex = graphicsQueueFamily;
+	queueCreateInfos[0].queueCount = 1;
+	queueCreateInfos[0].pQueuePriorities = &queuePriorities;
+	queueCreateInfos[1] = queueCreateInfos[0];
+	queueCreateInfos[1].queueFamilyIndex = transferQueueFamily;
 
 	VkDeviceCreateInfo deviceCreateInfo = {};
 	deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 	deviceCreateInfo.pNext = nullptr;
-	deviceCreateInfo.queueCreateInfoCount = 1;
-	deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
+	deviceCreateInfo.queueCreateInfoCount = transferQueueFamily != graphicsQueueFamily ? 2 : 1;
+	deviceCreateInfo.pQueueCreateInfos = queueCreateInfos;
 	deviceCreateInfo.pEnabledFeatures = &enabledFeatures;
 
 	const char *enabledExtensions[] = {
@@ -168,8 +257,43 @@ void vulkan::deviceInit(VkPhysicalDevice physicalDevice, function<bool(VkInstanc
 
 	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &deviceMemoryProperties);
 	vkGetDeviceQueue(device, graphicsQueueFamily, 0, &graphicsQueue);
+	vkGetDeviceQueue(device, transferQueueFamily, 0, &transferQueue);
 
 	setupCommandPool = createCommandPool(graphicsQueueFamily);
+
+	::pipelineCachePath = pipelineCachePath;
+	pipelineCache = loadPipelineCache(pipelineCachePath);
+}
+
+void vulkan::savePipelineCache()
+{
+	if (pipelineCachePath.empty())
+		return;
+
+	size_t size;
+	VkResult err = vkGetPipelineCacheData(device, pipelineCache, &size, nullptr);
+	assert(err == VK_SUCCESS);
+
+	vector<uint8_t> data(size);
+	err = vkGetPipelineCacheData(device, pipelineCache, &size, data.data());
+	assert(err == VK_SUCCESS);
+
+	// The cache is best-effort, so failing to write it is no error. A
+	// temporary file moved into place keeps a crash from leaving half a cache.
+	auto tempPath = pipelineCachePath + ".tmp";
+	FILE *fp = fopen(tempPath.c_str(), "wb");
+	if (fp == nullptr)
+		return;
+
+	bool ok = fwrite(data.data(), 1, size, fp) == size;
+	ok = fclose(fp) == 0 && ok;
+	if (!ok) {
+		remove(tempPath.c_str());
+		return;
+	}
+
+	if (!replaceFile(tempPath, pipelineCachePath))
+		remove(tempPath.c_str());
 }
 
 VkCommandBuffer vulkan::getSetupCommandBuffer()
@@ -8,6 +8,8 @@
 #include <algorithm>
 #include <functional>
 #include <vector>
+#include <string>
+#include <stdexcept>
 #include <cassert>
 #include <queue>
 
@@ -23,11 +25,18 @@ namespace vulkan
 	extern VkPhysicalDeviceMemoryProperties deviceMemoryProperties;
 	extern VkQueue graphicsQueue;
 	extern uint32_t graphicsQueueFamily;
+	extern VkQueue transferQueue; // same as graphicsQueue without a transfer-only family
+	extern uint32_t transferQueueFamily;
+	extern VkPipelineCache pipelineCache; // pass to every pipeline creation
 
 	extern VkDebugReportCallbackEXT debugReportCallback;
 
 	void instanceInit(const std::string &appName, const std::vector<const char *> &enabledExtensions);
-	void deviceInit(VkPhysicalDevice physicalDevice, std::function<bool(VkInstance, VkPhysicalDevice, uint32_t)> usableQueue);
+	// Seeds pipelineCache from pipelineCachePath, if that holds a cache from the same device and driver
+	void deviceInit(VkPhysicalDevice physicalDevice, std::function<bool(VkInstance, VkPhysicalDevice, uint32_t)> usableQueue, const std::string &pipelineCachePath = "");
+
+	// Writes pipelineCache back to the path given to deviceInit()
+	void savePipelineCache();
 
 	extern struct instance_funcs {
 		PFN_vkCreateDebugReportCallbackEXT vkCreateDebugReportCallbackEXT;
@@ -69,13 +78,13 @@ namespace vulkan
 		return deviceMemory;
 	}
 
-	inline std::vector<VkCommandBuffer> allocateCommandBuffers(VkCommandPool commandPool, size_t commandBufferCount)
+	inline std::vector<VkCommandBuffer> allocateCommandBuffers(VkCommandPool commandPool, size_t commandBufferCount, VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY)
 	{
 		assert(commandBufferCount < UINT32_MAX);
 		VkCommandBufferAllocateInfo commandAllocInfo = {};
 		commandAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 		commandAllocInfo.commandPool = commandPool;
-		commandAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		commandAllocInfo.level = level;
 		commandAllocInfo.commandBufferCount = uint32_t(commandBufferCount);
 
 		std::vector<VkCommandBuffer> commandBuffers;
@@ -109,6 +118,50 @@ namespace vulkan
 		throw std::runtime_error("no supported format!");
 	}
 
+	inline bool isBlockCompressed(VkFormat format)
+	{
+		return format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && format <= VK_FORMAT_BC7_SRGB_BLOCK;
+	}
+
+	// width and height of a texel block, in pixels
+	inline int getFormatBlockExtent(VkFormat format)
+	{
+		return isBlockCompressed(format) ? 4 : 1;
+	}
+
+	// size of a texel block, in bytes
+	inline VkDeviceSize getFormatSize(VkFormat format)
+	{
+		switch (format) {
+		case VK_FORMAT_R8G8B8A8_UNORM:
+		case VK_FORMAT_R8G8B8A8_SRGB:
+		case VK_FORMAT_B8G8R8A8_UNORM:
+		case VK_FORMAT_B8G8R8A8_SRGB:
+		case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+		case VK_FORMAT_B10G11R11_UFLOAT_PACK32:
+			return 4;
+
+		case VK_FORMAT_R16G16B16A16_SFLOAT:
+		case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+		case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+		case VK_FORMAT_BC4_UNORM_BLOCK:
+			return 8;
+
+		case VK_FORMAT_R32G32B32A32_SFLOAT:
+		case VK_FORMAT_BC3_UNORM_BLOCK:
+		case VK_FORMAT_BC3_SRGB_BLOCK:
+		case VK_FORMAT_BC5_UNORM_BLOCK:
+		case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+		case VK_FORMAT_BC7_UNORM_BLOCK:
+		case VK_FORMAT_BC7_SRGB_BLOCK:
+			return 16;
+
+		default:
+			assert(false);
+			throw std::runtime_error("unsupported format!");
+		}
+	}
+
 	inline VkFence createFence(VkFenceCreateFlags flags)
 	{
 		VkFenceCreateInfo fenceCreateInfo = {};